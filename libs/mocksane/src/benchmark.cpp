@@ -0,0 +1,150 @@
+#include "mocksane.h"
+#include "qtsanescanner/src/qtsanescanner.h"
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <cstdio>
+
+// measures the scan pipeline of the scanner library against simulated
+// devices, so that changes can be compared without hardware
+namespace
+{
+    struct Measurement
+    {
+        QElapsedTimer timer;
+        mocksane::CallCounts calls{ };
+        qint64 bytes{ };
+
+        Measurement()
+        {
+            mocksane::resetCallCounts();
+            timer.start();
+        }
+
+        void print(const char *name)
+        {
+            const auto nsec = timer.nsecsElapsed();
+            calls = mocksane::callCounts();
+            std::printf("%-24s %9.2f ms %9.1f MB/s %7d reads %7d option calls\n",
+                name, nsec / 1e6, (nsec ? bytes * 1e3 / nsec : 0.0),
+                calls.read, calls.controlOption);
+        }
+    };
+
+    mocksane::DeviceConfig makeDevice(std::string name)
+    {
+        // type is left at its default
+        auto device = mocksane::defaultDevices().front();
+        device.name = std::move(name);
+        device.model = device.name;
+        device.type = mocksane::DeviceConfig().type;
+        return device;
+    }
+
+    std::vector<mocksane::DeviceConfig> benchmarkDevices()
+    {
+        auto fast = makeDevice("bench:fast");
+        fast.maxReadLength = 256 * 1024;
+
+        auto latency = makeDevice("bench:latency");
+        latency.maxReadLength = 16 * 1024;
+        latency.readLatencyUsec = 100;
+        latency.readJitterUsec = 100;
+
+        auto frames = makeDevice("bench:frames");
+        frames.frame = SANE_FRAME_RED;
+        frames.linesKnown = false;
+
+        // many options make reloads expensive
+        auto options = makeDevice("bench:options");
+        for (auto i = 0; i < 200; ++i) {
+            auto option = mocksane::OptionConfig();
+            option.name = "option-" + std::to_string(i);
+            option.title = option.name;
+            option.words = { i };
+            options.options.push_back(option);
+        }
+        options.optionLatencyUsec = 20;
+        return { fast, latency, frames, options };
+    }
+
+    // reads a page, blocking or driven by the select descriptor
+    bool scanPage(QtSaneScanner &scanner, bool nonBlocking, qint64 *bytes)
+    {
+        if (!scanner.startScan())
+            return false;
+
+        auto buffer = QtSaneScanner::ScanBuffer();
+        const auto read = [&]() {
+            if (!scanner.readScanLines(buffer))
+                return false;
+            *bytes += buffer.lineCount() * buffer.bytesPerLine();
+            return true;
+        };
+
+        if (nonBlocking && scanner.setNonBlocking(true)) {
+            auto loop = QEventLoop();
+            QObject::connect(&scanner, &QtSaneScanner::scanDataAvailable,
+                &loop, [&]() {
+                    if (!read())
+                        loop.quit();
+                });
+            loop.exec();
+        }
+        else {
+            while (read())
+                continue;
+        }
+        const auto complete = scanner.isPageComplete();
+        scanner.cancelScan();
+        return complete;
+    }
+
+    void benchmarkScan(const char *name, const QString &deviceName,
+        bool nonBlocking)
+    {
+        auto scanner = QtSaneScanner(deviceName);
+        auto measurement = Measurement();
+        if (!scanPage(scanner, nonBlocking, &measurement.bytes))
+            std::printf("%-24s scan failed\n", name);
+        measurement.print(name);
+    }
+
+    void benchmarkReload(const char *name, const QString &deviceName)
+    {
+        // each mode change reloads all options, values are read lazily
+        auto scanner = QtSaneScanner(deviceName);
+        auto mode = scanner.findOption(QStringLiteral("mode"));
+        if (!mode)
+            return;
+
+        auto measurement = Measurement();
+        for (auto i = 0; i < 50; ++i) {
+            mode->setStringValue(i % 2 ? "Color" : "Gray");
+            for (const auto &option : scanner.options())
+                option.value();
+        }
+        measurement.print(name);
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto app = QCoreApplication(argc, argv);
+    mocksane::setDevices(benchmarkDevices());
+
+    const auto devices = QtSaneScanner::getDevices();
+    if (devices.size() != static_cast<int>(benchmarkDevices().size())) {
+        std::printf("simulated devices were not listed\n");
+        return 1;
+    }
+
+    benchmarkScan("read blocking", QStringLiteral("bench:fast"), false);
+    benchmarkScan("read non-blocking", QStringLiteral("bench:fast"), true);
+    benchmarkScan("read latency blocking", QStringLiteral("bench:latency"), false);
+    benchmarkScan("read latency select", QStringLiteral("bench:latency"), true);
+    benchmarkScan("read frames", QStringLiteral("bench:frames"), true);
+    benchmarkReload("reload options", QStringLiteral("bench:options"));
+
+    QtSaneScanner::shutdown();
+    return 0;
+}
@@ -0,0 +1,721 @@
+#include "mocksane.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+    using mocksane::OptionConfig;
+    using mocksane::DeviceConfig;
+
+    struct Option
+    {
+        OptionConfig config;
+        SANE_Option_Descriptor descriptor{ };
+        std::vector<SANE_String_Const> stringList;
+        std::vector<SANE_Word> wordList;
+        std::vector<SANE_Word> words;
+        std::string string;
+    };
+
+    struct Handle
+    {
+        DeviceConfig config;
+        std::vector<Option> options;
+        bool scanning{ };
+        bool cancelled{ };
+        bool frameComplete{ };
+        bool nonBlocking{ };
+        int page{ };
+        int frame{ };
+        SANE_Parameters parameters{ };
+        size_t frameSize{ };
+        size_t position{ };
+        int reads{ };
+        Clock::time_point nextDataTime;
+        std::mt19937 random;
+        int pipe[2]{ -1, -1 };
+
+        // select descriptor is only readable while data is ready
+        std::thread notifier;
+        std::mutex notifyMutex;
+        std::condition_variable notifyCondition;
+        Clock::time_point notifyTime;
+        bool notifyPending{ };
+        bool readable{ };
+        bool closing{ };
+    };
+
+    struct Counters
+    {
+        std::atomic<int> getOptionDescriptor;
+        std::atomic<int> controlOption;
+        std::atomic<int> getParameters;
+        std::atomic<int> start;
+        std::atomic<int> read;
+    };
+
+    std::mutex sMutex;
+    bool sDevicesSet;
+    std::vector<DeviceConfig> sDevices;
+    std::vector<SANE_Device> sDeviceList;
+    std::vector<const SANE_Device*> sDevicePointers;
+    Counters sCounters;
+
+    OptionConfig makeOption(std::string name, std::string title,
+        SANE_Value_Type type, std::vector<SANE_Word> words,
+        SANE_Unit unit = SANE_UNIT_NONE)
+    {
+        auto option = OptionConfig();
+        option.name = std::move(name);
+        option.title = std::move(title);
+        option.type = type;
+        option.unit = unit;
+        option.words = std::move(words);
+        return option;
+    }
+
+    OptionConfig makeStringOption(std::string name, std::string title,
+        std::vector<std::string> stringList, bool reloadsOptions = false)
+    {
+        auto option = OptionConfig();
+        option.name = std::move(name);
+        option.title = std::move(title);
+        option.type = SANE_TYPE_STRING;
+        option.string = stringList.front();
+        option.stringList = std::move(stringList);
+        option.reloadsOptions = reloadsOptions;
+        return option;
+    }
+
+    OptionConfig makeRangeOption(std::string name, std::string title,
+        SANE_Value_Type type, SANE_Range range, SANE_Word value,
+        SANE_Unit unit = SANE_UNIT_NONE)
+    {
+        auto option = makeOption(std::move(name), std::move(title),
+            type, { value }, unit);
+        option.hasRange = true;
+        option.range = range;
+        return option;
+    }
+
+    std::vector<OptionConfig> defaultOptions(bool feeder)
+    {
+        auto options = std::vector<OptionConfig>();
+        options.push_back(makeStringOption("mode", "Scan mode",
+            { "Color", "Gray", "Lineart" }, true));
+        options.back().togglesActive = { "depth" };
+        options.push_back(makeOption("depth", "Bit depth",
+            SANE_TYPE_INT, { 8 }));
+        options.back().wordList = { 8, 16 };
+        options.push_back(makeOption("resolution", "Scan resolution",
+            SANE_TYPE_INT, { 300 }, SANE_UNIT_DPI));
+        options.back().wordList = { 75, 150, 300, 600, 1200 };
+        options.push_back(makeOption("preview", "Preview",
+            SANE_TYPE_BOOL, { SANE_FALSE }));
+        options.push_back(makeStringOption("source", "Scan source",
+            feeder ? std::vector<std::string>{ "ADF", "ADF Duplex" } :
+                     std::vector<std::string>{ "Flatbed" }));
+        const auto maxX = SANE_FIX(215.9);
+        const auto maxY = SANE_FIX(297.0);
+        options.push_back(makeRangeOption("tl-x", "Top-left x",
+            SANE_TYPE_FIXED, { 0, maxX, 0 }, 0, SANE_UNIT_MM));
+        options.push_back(makeRangeOption("tl-y", "Top-left y",
+            SANE_TYPE_FIXED, { 0, maxY, 0 }, 0, SANE_UNIT_MM));
+        options.push_back(makeRangeOption("br-x", "Bottom-right x",
+            SANE_TYPE_FIXED, { 0, maxX, 0 }, maxX, SANE_UNIT_MM));
+        options.push_back(makeRangeOption("br-y", "Bottom-right y",
+            SANE_TYPE_FIXED, { 0, maxY, 0 }, maxY, SANE_UNIT_MM));
+        options.push_back(makeRangeOption("brightness", "Brightness",
+            SANE_TYPE_INT, { -100, 100, 5 }, 0));
+        options.push_back(makeOption("custom-gamma", "Use custom gamma table",
+            SANE_TYPE_BOOL, { SANE_FALSE }));
+        options.back().reloadsOptions = true;
+        options.back().togglesActive = { "gamma-table" };
+
+        auto gammaTable = std::vector<SANE_Word>(256);
+        for (auto i = 0; i < 256; ++i)
+            gammaTable[i] = i * 257;
+        options.push_back(makeRangeOption("gamma-table", "Gamma table",
+            SANE_TYPE_INT, { 0, 65535, 0 }, 0));
+        options.back().words = std::move(gammaTable);
+        options.back().cap |= SANE_CAP_INACTIVE | SANE_CAP_ADVANCED;
+        return options;
+    }
+
+    const Option *findOption(const Handle &handle, const std::string &name)
+    {
+        for (const auto &option : handle.options)
+            if (option.config.name == name)
+                return &option;
+        return nullptr;
+    }
+
+    void setupOptions(Handle &handle)
+    {
+        // option 0 is the number of options
+        auto &options = handle.options;
+        options.resize(handle.config.options.size() + 1);
+        options[0].config = makeOption("", "Number of options",
+            SANE_TYPE_INT, { static_cast<SANE_Word>(options.size()) });
+        options[0].config.cap = SANE_CAP_SOFT_DETECT;
+        for (auto i = size_t{ }; i < handle.config.options.size(); ++i)
+            options[i + 1].config = handle.config.options[i];
+
+        // descriptors point into the options, which are not moved anymore
+        for (auto &option : options) {
+            const auto &config = option.config;
+            auto &desc = option.descriptor;
+            option.words = config.words;
+            option.string = config.string;
+            desc.name = config.name.c_str();
+            desc.title = config.title.c_str();
+            desc.desc = config.title.c_str();
+            desc.type = config.type;
+            desc.unit = config.unit;
+            desc.cap = config.cap;
+            desc.size = (config.type == SANE_TYPE_STRING ?
+                std::max(config.stringSize,
+                    static_cast<int>(config.string.size()) + 1) :
+                static_cast<SANE_Int>(option.words.size() * sizeof(SANE_Word)));
+
+            if (!config.stringList.empty()) {
+                for (const auto &string : config.stringList)
+                    option.stringList.push_back(string.c_str());
+                option.stringList.push_back(nullptr);
+                desc.constraint_type = SANE_CONSTRAINT_STRING_LIST;
+                desc.constraint.string_list = option.stringList.data();
+            }
+            else if (!config.wordList.empty()) {
+                option.wordList.push_back(
+                    static_cast<SANE_Word>(config.wordList.size()));
+                option.wordList.insert(option.wordList.end(),
+                    config.wordList.begin(), config.wordList.end());
+                desc.constraint_type = SANE_CONSTRAINT_WORD_LIST;
+                desc.constraint.word_list = option.wordList.data();
+            }
+            else if (config.hasRange) {
+                desc.constraint_type = SANE_CONSTRAINT_RANGE;
+                desc.constraint.range = &config.range;
+            }
+        }
+    }
+
+    bool setWords(Option &option, const SANE_Word *words)
+    {
+        auto inexact = false;
+        const auto &desc = option.descriptor;
+        for (auto i = size_t{ }; i < option.words.size(); ++i) {
+            auto word = words[i];
+            if (desc.type == SANE_TYPE_BOOL)
+                word = (word != SANE_FALSE ? SANE_TRUE : SANE_FALSE);
+
+            if (desc.constraint_type == SANE_CONSTRAINT_RANGE) {
+                const auto &range = *desc.constraint.range;
+                auto clamped = std::clamp(word, range.min, range.max);
+                if (range.quant)
+                    clamped = range.min + (clamped - range.min + range.quant / 2) /
+                        range.quant * range.quant;
+                inexact |= (clamped != word);
+                word = clamped;
+            }
+            else if (desc.constraint_type == SANE_CONSTRAINT_WORD_LIST) {
+                // select nearest value in list
+                const auto &list = option.wordList;
+                auto nearest = list[1];
+                for (auto j = size_t{ 1 }; j < list.size(); ++j)
+                    if (std::abs(list[j] - word) < std::abs(nearest - word))
+                        nearest = list[j];
+                inexact |= (nearest != word);
+                word = nearest;
+            }
+            option.words[i] = word;
+        }
+        return inexact;
+    }
+
+    SANE_Parameters getParameters(const Handle &handle)
+    {
+        const auto &config = handle.config;
+        auto frame = config.frame;
+        auto depth = config.depth;
+        if (auto mode = findOption(handle, "mode")) {
+            if (mode->string == "Gray") {
+                frame = SANE_FRAME_GRAY;
+            }
+            else if (mode->string == "Lineart") {
+                frame = SANE_FRAME_GRAY;
+                depth = 1;
+            }
+        }
+        if (auto option = findOption(handle, "depth"))
+            if (!(option->descriptor.cap & SANE_CAP_INACTIVE) && depth != 1)
+                depth = option->words.front();
+
+        const auto separateFrames = (frame == SANE_FRAME_RED ||
+            frame == SANE_FRAME_GREEN || frame == SANE_FRAME_BLUE);
+        if (separateFrames)
+            frame = static_cast<SANE_Frame>(SANE_FRAME_RED + handle.frame);
+        const auto channels = (frame == SANE_FRAME_RGB ? 3 : 1);
+
+        auto parameters = SANE_Parameters{ };
+        parameters.format = frame;
+        parameters.last_frame = (!separateFrames || frame == SANE_FRAME_BLUE ?
+            SANE_TRUE : SANE_FALSE);
+        parameters.pixels_per_line = config.pixelsPerLine;
+        parameters.bytes_per_line = (depth == 1 ?
+            (config.pixelsPerLine + 7) / 8 :
+            config.pixelsPerLine * channels * depth / 8);
+        parameters.lines = (config.linesKnown ? config.lines : -1);
+        parameters.depth = depth;
+        return parameters;
+    }
+
+    void sleep(int usec)
+    {
+        if (usec > 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(usec));
+    }
+
+    int getReadDelay(Handle &handle)
+    {
+        const auto &config = handle.config;
+        auto delay = config.readLatencyUsec;
+        if (config.readJitterUsec > 0)
+            delay += std::uniform_int_distribution<int>(
+                0, config.readJitterUsec)(handle.random);
+        return delay;
+    }
+
+    void fillPattern(const Handle &handle, SANE_Byte *data, size_t length)
+    {
+        // deterministic gradient, which differs between lines
+        const auto bytesPerLine = static_cast<size_t>(
+            std::max(handle.parameters.bytes_per_line, 1));
+        for (auto i = size_t{ }; i < length; ++i) {
+            const auto offset = handle.position + i;
+            data[i] = static_cast<SANE_Byte>(
+                offset / bytesPerLine + offset % bytesPerLine);
+        }
+    }
+
+    // called with the notify mutex locked
+    void setReadable(Handle &handle, bool readable)
+    {
+        auto byte = char{ };
+        if (readable && !handle.readable)
+            handle.readable = (::write(handle.pipe[1], "", 1) == 1);
+        else if (!readable && handle.readable)
+            handle.readable = (::read(handle.pipe[0], &byte, 1) != 1);
+    }
+
+    // makes the select descriptor readable when the next data is ready
+    void scheduleData(Handle &handle, Clock::time_point time)
+    {
+        auto lock = std::lock_guard<std::mutex>(handle.notifyMutex);
+        setReadable(handle, false);
+        handle.notifyTime = time;
+        handle.notifyPending = true;
+        handle.notifyCondition.notify_one();
+    }
+
+    void cancelData(Handle &handle)
+    {
+        auto lock = std::lock_guard<std::mutex>(handle.notifyMutex);
+        setReadable(handle, false);
+        handle.notifyPending = false;
+    }
+
+    void runNotifier(Handle *handle)
+    {
+        auto lock = std::unique_lock<std::mutex>(handle->notifyMutex);
+        while (!handle->closing) {
+            if (!handle->notifyPending) {
+                handle->notifyCondition.wait(lock);
+            }
+            else if (Clock::now() < handle->notifyTime) {
+                handle->notifyCondition.wait_until(lock, handle->notifyTime);
+            }
+            else {
+                setReadable(*handle, true);
+                handle->notifyPending = false;
+            }
+        }
+    }
+
+    Handle *toHandle(SANE_Handle handle)
+    {
+        return static_cast<Handle*>(handle);
+    }
+} // namespace
+
+namespace mocksane
+{
+    std::vector<DeviceConfig> defaultDevices()
+    {
+        auto flatbed = DeviceConfig();
+        flatbed.name = "mock:flatbed";
+        flatbed.model = "Flatbed";
+        flatbed.type = "flatbed scanner";
+        flatbed.options = defaultOptions(false);
+
+        auto feeder = DeviceConfig();
+        feeder.name = "mock:feeder";
+        feeder.model = "Sheetfed";
+        feeder.type = "sheetfed scanner";
+        feeder.options = defaultOptions(true);
+        feeder.frame = SANE_FRAME_RED;
+        feeder.linesKnown = false;
+        feeder.pages = 5;
+        feeder.maxReadLength = 8 * 1024;
+        feeder.readLatencyUsec = 500;
+        feeder.readJitterUsec = 500;
+        return { flatbed, feeder };
+    }
+
+    void setDevices(std::vector<DeviceConfig> devices)
+    {
+        auto lock = std::lock_guard<std::mutex>(sMutex);
+        sDevices = std::move(devices);
+        sDevicesSet = true;
+    }
+
+    CallCounts callCounts()
+    {
+        return {
+            sCounters.getOptionDescriptor.load(),
+            sCounters.controlOption.load(),
+            sCounters.getParameters.load(),
+            sCounters.start.load(),
+            sCounters.read.load(),
+        };
+    }
+
+    void resetCallCounts()
+    {
+        sCounters.getOptionDescriptor = 0;
+        sCounters.controlOption = 0;
+        sCounters.getParameters = 0;
+        sCounters.start = 0;
+        sCounters.read = 0;
+    }
+} // namespace mocksane
+
+SANE_Status sane_init(SANE_Int *version_code, SANE_Auth_Callback)
+{
+    auto lock = std::lock_guard<std::mutex>(sMutex);
+    if (!sDevicesSet) {
+        sDevices = mocksane::defaultDevices();
+        sDevicesSet = true;
+    }
+    if (version_code)
+        *version_code = SANE_VERSION_CODE(SANE_CURRENT_MAJOR, 0, 0);
+    return SANE_STATUS_GOOD;
+}
+
+void sane_exit()
+{
+    auto lock = std::lock_guard<std::mutex>(sMutex);
+    sDevicePointers.clear();
+    sDeviceList.clear();
+}
+
+SANE_Status sane_get_devices(const SANE_Device ***device_list, SANE_Bool)
+{
+    auto lock = std::lock_guard<std::mutex>(sMutex);
+    sDeviceList.clear();
+    for (const auto &device : sDevices)
+        sDeviceList.push_back({ device.name.c_str(), device.vendor.c_str(),
+            device.model.c_str(), device.type.c_str() });
+
+    sDevicePointers.clear();
+    for (const auto &device : sDeviceList)
+        sDevicePointers.push_back(&device);
+    sDevicePointers.push_back(nullptr);
+    *device_list = sDevicePointers.data();
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status sane_open(SANE_String_Const devicename, SANE_Handle *handle)
+{
+    auto lock = std::lock_guard<std::mutex>(sMutex);
+    const auto it = std::find_if(sDevices.begin(), sDevices.end(),
+        [&](const DeviceConfig &device) {
+            return (!*devicename || device.name == devicename);
+        });
+    if (it == sDevices.end())
+        return SANE_STATUS_INVAL;
+
+    auto device = new Handle();
+    device->config = *it;
+    device->random.seed(static_cast<unsigned int>(
+        std::hash<std::string>()(device->config.name)));
+    setupOptions(*device);
+
+    // a pipe is selected in non-blocking mode, which is written to
+    // when data is ready
+    if (device->config.supportsNonBlocking) {
+        if (::pipe(device->pipe) == 0)
+            device->notifier = std::thread(runNotifier, device);
+        else
+            device->config.supportsNonBlocking = false;
+    }
+
+    *handle = device;
+    return SANE_STATUS_GOOD;
+}
+
+void sane_close(SANE_Handle handle)
+{
+    auto device = toHandle(handle);
+    if (device->notifier.joinable()) {
+        {
+            auto lock = std::lock_guard<std::mutex>(device->notifyMutex);
+            device->closing = true;
+            device->notifyCondition.notify_one();
+        }
+        device->notifier.join();
+    }
+    for (auto fd : device->pipe)
+        if (fd >= 0)
+            ::close(fd);
+    delete device;
+}
+
+const SANE_Option_Descriptor *sane_get_option_descriptor(
+    SANE_Handle handle, SANE_Int option)
+{
+    ++sCounters.getOptionDescriptor;
+    auto &options = toHandle(handle)->options;
+    if (option < 0 || option >= static_cast<SANE_Int>(options.size()))
+        return nullptr;
+    return &options[option].descriptor;
+}
+
+SANE_Status sane_control_option(SANE_Handle handle, SANE_Int option,
+    SANE_Action action, void *value, SANE_Int *info)
+{
+    ++sCounters.controlOption;
+    auto device = toHandle(handle);
+    auto &options = device->options;
+    if (info)
+        *info = 0;
+    if (option < 0 || option >= static_cast<SANE_Int>(options.size()))
+        return SANE_STATUS_INVAL;
+
+    sleep(device->config.optionLatencyUsec);
+
+    auto &opt = options[option];
+    const auto &desc = opt.descriptor;
+    if (desc.cap & SANE_CAP_INACTIVE)
+        return SANE_STATUS_INVAL;
+
+    if (action == SANE_ACTION_GET_VALUE) {
+        if (desc.type == SANE_TYPE_STRING)
+            std::strncpy(static_cast<char*>(value), opt.string.c_str(),
+                static_cast<size_t>(desc.size));
+        else if (desc.size > 0)
+            std::memcpy(value, opt.words.data(),
+                static_cast<size_t>(desc.size));
+        return SANE_STATUS_GOOD;
+    }
+
+    if (action != SANE_ACTION_SET_VALUE || !(desc.cap & SANE_CAP_SOFT_SELECT))
+        return SANE_STATUS_INVAL;
+
+    if (device->scanning)
+        return SANE_STATUS_DEVICE_BUSY;
+
+    auto changed = false;
+    auto inexact = false;
+    if (desc.type == SANE_TYPE_STRING) {
+        const auto string = std::string(static_cast<const char*>(value));
+        const auto &list = opt.config.stringList;
+        if (!list.empty() &&
+            std::find(list.begin(), list.end(), string) == list.end())
+            return SANE_STATUS_INVAL;
+        changed = (string != opt.string);
+        opt.string = string;
+    }
+    else {
+        const auto previous = opt.words;
+        inexact = setWords(opt, static_cast<const SANE_Word*>(value));
+        changed = (previous != opt.words);
+    }
+
+    auto result = SANE_Int{ SANE_INFO_RELOAD_PARAMS };
+    if (inexact)
+        result |= SANE_INFO_INEXACT;
+
+    if (changed && opt.config.reloadsOptions) {
+        for (const auto &name : opt.config.togglesActive)
+            for (auto &other : options)
+                if (other.config.name == name)
+                    other.descriptor.cap ^= SANE_CAP_INACTIVE;
+        result |= SANE_INFO_RELOAD_OPTIONS;
+    }
+    if (info)
+        *info = result;
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status sane_get_parameters(SANE_Handle handle, SANE_Parameters *params)
+{
+    ++sCounters.getParameters;
+    auto device = toHandle(handle);
+    *params = (device->scanning ? device->parameters : getParameters(*device));
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status sane_start(SANE_Handle handle)
+{
+    ++sCounters.start;
+    auto device = toHandle(handle);
+    const auto &config = device->config;
+
+    if (device->scanning && !device->frameComplete)
+        return SANE_STATUS_DEVICE_BUSY;
+
+    if (device->scanning && !device->parameters.last_frame) {
+        // next frame of a multi-frame scan
+        ++device->frame;
+    }
+    else {
+        if (config.pages >= 0 && device->page >= config.pages)
+            return SANE_STATUS_NO_DOCS;
+        if (device->page == config.failStartAtPage)
+            return config.startStatus;
+        ++device->page;
+        device->frame = 0;
+    }
+
+    device->scanning = true;
+    device->cancelled = false;
+    device->frameComplete = false;
+    device->nonBlocking = false;
+    cancelData(*device);
+    device->parameters = getParameters(*device);
+    const auto lines = (config.linesKnown ? config.lines : std::max(config.lines, 0));
+    device->frameSize = static_cast<size_t>(device->parameters.bytes_per_line) *
+        static_cast<size_t>(lines);
+    device->position = 0;
+    device->reads = 0;
+    device->nextDataTime = Clock::now() +
+        std::chrono::microseconds(getReadDelay(*device));
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status sane_read(SANE_Handle handle, SANE_Byte *data,
+    SANE_Int max_length, SANE_Int *length)
+{
+    ++sCounters.read;
+    auto device = toHandle(handle);
+    const auto &config = device->config;
+    *length = 0;
+
+    if (device->cancelled)
+        return SANE_STATUS_CANCELLED;
+    if (!device->scanning)
+        return SANE_STATUS_INVAL;
+
+    if (config.failAfterReads >= 0 && device->reads >= config.failAfterReads)
+        return config.readStatus;
+    ++device->reads;
+
+    if (device->position >= device->frameSize) {
+        device->frameComplete = true;
+        return SANE_STATUS_EOF;
+    }
+
+    // non-blocking reads return nothing until the latency elapsed
+    if (device->nonBlocking) {
+        if (Clock::now() < device->nextDataTime) {
+            scheduleData(*device, device->nextDataTime);
+            return SANE_STATUS_GOOD;
+        }
+        device->nextDataTime = Clock::now() +
+            std::chrono::microseconds(getReadDelay(*device));
+    }
+    else {
+        sleep(getReadDelay(*device));
+    }
+
+    // partial reads are limited to the configured length
+    const auto available = device->frameSize - device->position;
+    const auto count = std::min({ available,
+        static_cast<size_t>(std::max(max_length, 0)),
+        static_cast<size_t>(std::max(config.maxReadLength, 1)) });
+    fillPattern(*device, data, count);
+    device->position += count;
+    *length = static_cast<SANE_Int>(count);
+
+    // end of frame can be read right away
+    if (device->nonBlocking)
+        scheduleData(*device, device->position < device->frameSize ?
+            device->nextDataTime : Clock::now());
+    return SANE_STATUS_GOOD;
+}
+
+void sane_cancel(SANE_Handle handle)
+{
+    // feeder is refilled, so that scans can be repeated
+    auto device = toHandle(handle);
+    device->cancelled = device->scanning;
+    device->scanning = false;
+    device->nonBlocking = false;
+    device->page = 0;
+    cancelData(*device);
+}
+
+SANE_Status sane_set_io_mode(SANE_Handle handle, SANE_Bool non_blocking)
+{
+    auto device = toHandle(handle);
+    if (!device->scanning)
+        return SANE_STATUS_INVAL;
+    if (non_blocking && !device->config.supportsNonBlocking)
+        return SANE_STATUS_UNSUPPORTED;
+    device->nonBlocking = (non_blocking != SANE_FALSE);
+    if (device->nonBlocking)
+        scheduleData(*device, device->nextDataTime);
+    else
+        cancelData(*device);
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status sane_get_select_fd(SANE_Handle handle, SANE_Int *fd)
+{
+    auto device = toHandle(handle);
+    if (!device->config.supportsNonBlocking)
+        return SANE_STATUS_UNSUPPORTED;
+    if (!device->scanning)
+        return SANE_STATUS_INVAL;
+    *fd = device->pipe[0];
+    return SANE_STATUS_GOOD;
+}
+
+SANE_String_Const sane_strstatus(SANE_Status status)
+{
+    switch (status) {
+        case SANE_STATUS_GOOD: return "Success";
+        case SANE_STATUS_UNSUPPORTED: return "Operation not supported";
+        case SANE_STATUS_CANCELLED: return "Operation was cancelled";
+        case SANE_STATUS_DEVICE_BUSY: return "Device busy";
+        case SANE_STATUS_INVAL: return "Invalid argument";
+        case SANE_STATUS_EOF: return "End of file reached";
+        case SANE_STATUS_JAMMED: return "Document feeder jammed";
+        case SANE_STATUS_NO_DOCS: return "Document feeder out of documents";
+        case SANE_STATUS_COVER_OPEN: return "Scanner cover is open";
+        case SANE_STATUS_IO_ERROR: return "Error during device I/O";
+        case SANE_STATUS_NO_MEM: return "Out of memory";
+        case SANE_STATUS_ACCESS_DENIED: return "Access to resource has been denied";
+    }
+    return "Unknown SANE status code";
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <sane/sane.h>
+#include <string>
+#include <vector>
+
+// in-process replacement of libsane, which simulates devices, so that the
+// scan pipeline can be benchmarked without hardware
+namespace mocksane
+{
+    struct OptionConfig
+    {
+        std::string name;
+        std::string title;
+        SANE_Value_Type type{ SANE_TYPE_INT };
+        SANE_Unit unit{ SANE_UNIT_NONE };
+        SANE_Int cap{ SANE_CAP_SOFT_SELECT | SANE_CAP_SOFT_DETECT };
+        // maximum length of string values
+        int stringSize{ 64 };
+        // constraint, when not empty
+        std::vector<SANE_Word> wordList;
+        std::vector<std::string> stringList;
+        bool hasRange{ };
+        SANE_Range range{ };
+        // initial value, the number of words determines the option size
+        std::vector<SANE_Word> words;
+        std::string string;
+        // changing the value requests a reload and toggles other options
+        bool reloadsOptions{ };
+        std::vector<std::string> togglesActive;
+    };
+
+    struct DeviceConfig
+    {
+        std::string name;
+        std::string vendor{ "Mock" };
+        std::string model;
+        std::string type{ "flatbed scanner" };
+        std::vector<OptionConfig> options;
+
+        // a "mode" option set to "Gray" or "Lineart" selects a gray frame,
+        // red frame selects separate frames for each color
+        SANE_Frame frame{ SANE_FRAME_RGB };
+        int depth{ 8 };
+        int pixelsPerLine{ 2480 };
+        int lines{ 3508 };
+        bool linesKnown{ true };
+        // pages until SANE_STATUS_NO_DOCS is returned, -1 for unlimited
+        int pages{ -1 };
+
+        // behaviour of calls
+        int maxReadLength{ 32 * 1024 };
+        int readLatencyUsec{ };
+        int readJitterUsec{ };
+        int optionLatencyUsec{ };
+        bool supportsNonBlocking{ true };
+
+        // injected errors, -1 to disable
+        int failStartAtPage{ -1 };
+        SANE_Status startStatus{ SANE_STATUS_JAMMED };
+        int failAfterReads{ -1 };
+        SANE_Status readStatus{ SANE_STATUS_IO_ERROR };
+    };
+
+    struct CallCounts
+    {
+        int getOptionDescriptor;
+        int controlOption;
+        int getParameters;
+        int start;
+        int read;
+    };
+
+    std::vector<DeviceConfig> defaultDevices();
+    // replaces the simulated devices, which are open devices keep using
+    void setDevices(std::vector<DeviceConfig> devices);
+    CallCounts callCounts();
+    void resetCallCounts();
+} // namespace mocksane
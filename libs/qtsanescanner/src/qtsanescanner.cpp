@@ -1,14 +1,33 @@
 #include "qtsanescanner.h"
 #include <QDebug>
+#include <QDataStream>
+#include <QHash>
 #include <QMutexLocker>
+#include <QSocketNotifier>
 #include <sane/sane.h>
+#include <algorithm>
+#include <cstring>
+#include <utility>
 
 int QtSaneScanner::sSaneVersionCode;
 
 struct QtSaneScanner::OptionDescriptor : SANE_Option_Descriptor { };
 
+// queues the requests of other threads for the device thread,
+// the scanner is detached before it is deleted
+class QtSaneScanner::DeviceContext : public QObject
+{
+public:
+    QMutex mutex;
+    QtSaneScanner *scanner{ };
+    QList<OptionWrite> writes;
+    QVector<int> reads;
+};
+
 namespace
 {
+    const auto snapshotVersion = quint32{ 1 };
+
     template<typename... T>
     void error(SANE_Status status, T&&... action)
     {
@@ -49,24 +68,89 @@ namespace
         });
     }
 
+    void recordRead(QtSaneScanner::ScanStatistics &stats,
+        qint64 latencyNsec, qint64 endUsec, int length)
+    {
+        const auto latencyUsec = latencyNsec / 1000;
+        auto bucket = 0;
+        while ((qint64{ 1 } << bucket) <= latencyUsec &&
+               bucket < QtSaneScanner::ScanStatistics::LatencyBuckets - 1)
+            ++bucket;
+        ++stats.readLatencies[bucket];
+        ++stats.reads;
+        stats.readUsec += latencyUsec;
+        if (!length) {
+            ++stats.emptyReads;
+            return;
+        }
+        if (stats.firstByteUsec < 0)
+            stats.firstByteUsec = endUsec;
+        stats.lastByteUsec = endUsec;
+        stats.bytesRead += length;
+        stats.maxBytesPerRead = std::max(stats.maxBytesPerRead, length);
+    }
+
+    void recordGap(QtSaneScanner::ScanStatistics &stats, qint64 gapNsec)
+    {
+        const auto gapUsec = gapNsec / 1000;
+        stats.gapUsec += gapUsec;
+        stats.maxGapUsec = std::max(stats.maxGapUsec, gapUsec);
+    }
+
     double toValue(SANE_Value_Type type, const SANE_Word &word)
     {
         return (type == SANE_TYPE_FIXED ?
             SANE_UNFIX(word) : static_cast<double>(word));
     }
+
+    size_t getFingerprint(const SANE_Option_Descriptor &desc)
+    {
+        const SANE_Word header[] = {
+            desc.type, desc.unit, desc.size, desc.cap, desc.constraint_type
+        };
+        auto seed = qHashBits(header, sizeof(header));
+
+        switch (desc.constraint_type) {
+            case SANE_CONSTRAINT_NONE:
+                break;
+
+            case SANE_CONSTRAINT_RANGE:
+                seed = qHashBits(desc.constraint.range,
+                    sizeof(SANE_Range), seed);
+                break;
+
+            case SANE_CONSTRAINT_WORD_LIST:
+                seed = qHashBits(desc.constraint.word_list,
+                    (desc.constraint.word_list[0] + 1) * sizeof(SANE_Word), seed);
+                break;
+
+            case SANE_CONSTRAINT_STRING_LIST:
+                forEachStringInList(desc, [&](const char *string) {
+                    seed = qHashBits(string, std::strlen(string) + 1, seed);
+                });
+                break;
+        }
+        return seed;
+    }
 } // namespace
 
-auto QtSaneScanner::initialize() -> QList<DeviceInfo>
+bool QtSaneScanner::initialize()
 {
-    shutdown();
-
-    check(sane_init(&sSaneVersionCode, nullptr), "initializing SANE");
     if (!sSaneVersionCode)
+        check(sane_init(&sSaneVersionCode, nullptr), "initializing SANE");
+    return (sSaneVersionCode != 0);
+}
+
+auto QtSaneScanner::getDevices() -> QList<DeviceInfo>
+{
+    if (!initialize())
         return { };
 
     auto deviceList = std::add_pointer_t<std::add_pointer_t<SANE_Device>>{ };
     check(sane_get_devices(const_cast<const SANE_Device***>(&deviceList), true),
           "enumerating devices");
+    if (!deviceList)
+        return { };
 
     auto devices = QList<DeviceInfo>();
     for (auto i = 0; deviceList[i]; ++i) {
@@ -103,7 +187,57 @@ QtSaneScanner::Option::Option(QtSaneScanner *scanner,
 {
 }
 
-void QtSaneScanner::Option::update(const OptionDescriptor &desc)
+QtSaneScanner::Option::Option(QtSaneScanner *scanner, int optionIndex)
+    : mScanner(scanner)
+    , mIndex(optionIndex)
+{
+}
+
+bool QtSaneScanner::Option::update(const OptionDescriptor &desc)
+{
+    if (!updateFingerprint(getFingerprint(desc),
+            SANE_OPTION_IS_ACTIVE(desc.cap)))
+        return false;
+    readDescriptor(desc);
+    return true;
+}
+
+bool QtSaneScanner::Option::update(const Option &read)
+{
+    // descriptor was read on the device thread
+    if (!updateFingerprint(read.mFingerprint, read.isActive()))
+        return false;
+    assignDescriptor(read);
+    return true;
+}
+
+void QtSaneScanner::Option::assignDescriptor(const Option &other)
+{
+    mFlags = other.mFlags;
+    mUnit = other.mUnit;
+    mType = other.mType;
+    mAllowedValues = other.mAllowedValues;
+    mAllowedRange = other.mAllowedRange;
+}
+
+bool QtSaneScanner::Option::updateFingerprint(size_t fingerprint, bool active)
+{
+    // an eager update would have read the value of each active option
+    auto &statistics = mScanner->mOptionStatistics;
+    if (active)
+        ++statistics.eagerValueGets;
+
+    // only rebuild and read value again when descriptor changed
+    ++statistics.descriptorUpdates;
+    if (fingerprint == mFingerprint)
+        return false;
+    ++statistics.descriptorChanges;
+    mFingerprint = fingerprint;
+    invalidateValue();
+    return true;
+}
+
+void QtSaneScanner::Option::readDescriptor(const OptionDescriptor &desc)
 {
     mFlags = desc.cap;
     mUnit = static_cast<Unit>(desc.unit);
@@ -159,20 +293,278 @@ void QtSaneScanner::Option::update(const OptionDescriptor &desc)
                 [&](auto&& value) { mAllowedValues << value; });
             break;
     }
+}
 
-    if (isActive())
-        mValue = mScanner->getOptionValue(mIndex);
+auto QtSaneScanner::Option::typedValue() const -> Value
+{
+    auto value = Value{ };
+    readValue(&value);
+    return value;
 }
 
-void QtSaneScanner::Option::setValue(const QVariant &value)
+bool QtSaneScanner::Option::readValue(Value *value) const
 {
-    if (mValue != value) {
-        mValue = value;
-        mScanner->handleOptionValueChanged(mIndex);
+    if (isActive() && !isValueCached())
+        mScanner->fetchOptionValue(mIndex);
+
+    // copy is shared, the value may be replaced by another thread
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    *value = mValue;
+    return mValueKnown;
+}
+
+void QtSaneScanner::Option::setTypedValue(Value value)
+{
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    if (mValueCached && mValue == value)
+        return;
+    mValue = value;
+    mValueCached = true;
+    mValueKnown = true;
+    lock.unlock();
+
+    // the value is passed on, so the member is not read again
+    mScanner->handleOptionValueChanged(mIndex, std::move(value));
+}
+
+bool QtSaneScanner::Option::isValueCached() const
+{
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    return mValueCached;
+}
+
+void QtSaneScanner::Option::cacheValue(Value value)
+{
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    mValue = std::move(value);
+    mValueCached = true;
+    mValueKnown = true;
+}
+
+bool QtSaneScanner::Option::cacheReadValue(Value value, int sequence)
+{
+    // keep value which was set after it was read
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    mValueRequested = false;
+    if (mWriteSequence.loadAcquire() != sequence || mHasUnappliedValue)
+        return false;
+    const auto changed = (!mValueKnown || mValue != value);
+    mValue = std::move(value);
+    mValueCached = true;
+    mValueKnown = true;
+    return changed;
+}
+
+bool QtSaneScanner::Option::requestValue()
+{
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    return !std::exchange(mValueRequested, true);
+}
+
+void QtSaneScanner::Option::cancelValueRequest()
+{
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    mValueRequested = false;
+}
+
+void QtSaneScanner::Option::invalidateValue()
+{
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    mValueCached = false;
+}
+
+bool QtSaneScanner::Option::invalidateAppliedValue()
+{
+    // value which was set but not applied yet is kept
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    if (!mValueCached || mHasUnappliedValue)
+        return false;
+    mValueCached = false;
+    return true;
+}
+
+void QtSaneScanner::Option::setUnappliedValue(Value value)
+{
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    mUnappliedValue = std::move(value);
+    mHasUnappliedValue = true;
+}
+
+bool QtSaneScanner::Option::takeUnappliedValue(Value *value)
+{
+    auto lock = QMutexLocker(&mScanner->mValueMutex);
+    if (!mHasUnappliedValue)
+        return false;
+    mHasUnappliedValue = false;
+    *value = std::exchange(mUnappliedValue, { });
+    return true;
+}
+
+auto QtSaneScanner::Option::fromVariant(const QVariant &variant) const -> Value
+{
+    auto value = Value{ };
+    switch (mType) {
+        case Type::Bool: value.word = variant.toBool(); break;
+        case Type::Int: value.word = variant.toInt(); break;
+        case Type::Value: value.word = SANE_FIX(variant.toDouble()); break;
+        case Type::String: value.string = variant.toString().toUtf8(); break;
+        case Type::BoolList:
+        case Type::IntList:
+        case Type::ValueList: {
+            const auto list = variant.toList();
+            value.words.reserve(list.size());
+            for (const auto &item : list)
+                value.words.append(mType == Type::ValueList ?
+                    SANE_FIX(item.toDouble()) : item.toInt());
+            break;
+        }
+        case Type::Button:
+        case Type::Group: break;
+    }
+    return value;
+}
+
+QVariant QtSaneScanner::Option::toVariant(const Value &value) const
+{
+    switch (mType) {
+        case Type::Bool: return static_cast<bool>(value.word);
+        case Type::Int: return value.word;
+        case Type::Value: return SANE_UNFIX(value.word);
+        case Type::String: return QString::fromUtf8(value.string);
+        case Type::BoolList:
+        case Type::IntList:
+        case Type::ValueList: {
+            auto list = QVariantList();
+            list.reserve(value.words.size());
+            for (auto word : value.words)
+                list.append(mType == Type::ValueList ?
+                    QVariant(SANE_UNFIX(word)) : QVariant(word));
+            return list;
+        }
+        case Type::Button:
+        case Type::Group: break;
     }
+    return { };
+}
+
+QVariant QtSaneScanner::Option::value() const
+{
+    if (!isActive() && !isValueCached())
+        return { };
+
+    // value which was not read yet is unknown
+    auto value = Value{ };
+    if (!readValue(&value))
+        return { };
+    return toVariant(value);
+}
+
+void QtSaneScanner::Option::setValue(const QVariant &value)
+{
+    setTypedValue(fromVariant(value));
+}
+
+bool QtSaneScanner::Option::boolValue() const
+{
+    return (intValue() != 0);
+}
+
+int QtSaneScanner::Option::intValue() const
+{
+    const auto word = typedValue().word;
+    return (mType == Type::Value ? qRound(SANE_UNFIX(word)) : word);
+}
+
+double QtSaneScanner::Option::doubleValue() const
+{
+    const auto word = typedValue().word;
+    return (mType == Type::Value ? SANE_UNFIX(word) : word);
+}
+
+int QtSaneScanner::Option::fixedValue() const
+{
+    const auto word = typedValue().word;
+    return (mType == Type::Value ? word : SANE_FIX(word));
+}
+
+QByteArray QtSaneScanner::Option::stringValue() const
+{
+    return typedValue().string;
+}
+
+QVector<int> QtSaneScanner::Option::listValue() const
+{
+    return typedValue().words;
+}
+
+void QtSaneScanner::Option::setBoolValue(bool value)
+{
+    setIntValue(value ? SANE_TRUE : SANE_FALSE);
+}
+
+void QtSaneScanner::Option::setIntValue(int value)
+{
+    setTypedValue({ mType == Type::Value ? SANE_FIX(value) : value });
+}
+
+void QtSaneScanner::Option::setDoubleValue(double value)
+{
+    setTypedValue({ mType == Type::Value ? SANE_FIX(value) : qRound(value) });
+}
+
+void QtSaneScanner::Option::setFixedValue(int value)
+{
+    setTypedValue({ mType == Type::Value ? value : qRound(SANE_UNFIX(value)) });
+}
+
+void QtSaneScanner::Option::setStringValue(const QByteArray &value)
+{
+    setTypedValue({ 0, value });
+}
+
+void QtSaneScanner::Option::setListValue(QVector<int> value)
+{
+    setTypedValue({ 0, { }, std::move(value) });
+}
+
+QtSaneScanner::ScanBuffer::ScanBuffer(int blockSize)
+    : mBlockSize(blockSize)
+{
+}
+
+void QtSaneScanner::ScanBuffer::reset(int scanId, const Parameters &parameters)
+{
+    mScanId = scanId;
+    mBytesPerLine = std::max(parameters.bytesPerLine, 1);
+    mFrame = parameters.frame;
+    mLineCount = 0;
+    mSize = 0;
+
+    // buffer holds as many complete lines as fit into a block
+    const auto capacity =
+        std::max(mBlockSize / mBytesPerLine, 1) * mBytesPerLine;
+    if (mData.size() != capacity)
+        mData = QByteArray(capacity, Qt::Uninitialized);
+}
+
+void QtSaneScanner::ScanBuffer::discardLines()
+{
+    // move incomplete line to front
+    const auto consumed = mLineCount * mBytesPerLine;
+    if (consumed && mSize > consumed)
+        std::memmove(mData.data(), mData.data() + consumed, mSize - consumed);
+    mSize -= consumed;
+    mLineCount = 0;
+}
+
+void QtSaneScanner::ScanBuffer::append(int length)
+{
+    mSize += length;
+    mLineCount = mSize / mBytesPerLine;
 }
 
 QtSaneScanner::QtSaneScanner(const QString &deviceName)
+    : mDeviceName(deviceName)
 {
     check(sane_open(qUtf8Printable(deviceName), &mDeviceHandle),
         "opening device ", deviceName);
@@ -185,96 +577,370 @@ QtSaneScanner::QtSaneScanner(const QString &deviceName)
         mOptions.append(Option(this, i - 1, *desc));
         mOptions.back().update(*desc);
     }
-    for (auto &option : mOptions)
-        mOptionMap[option.name()] = &option;
+    indexOptions();
+}
+
+QtSaneScanner::QtSaneScanner(const QString &deviceName, QDataStream &snapshot)
+    : mDeviceName(deviceName)
+{
+    auto version = quint32{ };
+    auto count = qint32{ };
+    snapshot >> version >> count;
+    if (version != snapshotVersion || count < 0)
+        return;
+
+    for (auto i = 0; i < count; ++i) {
+        auto option = Option(this, i);
+        auto flags = quint32{ };
+        auto type = qint32{ };
+        auto unit = qint32{ };
+        auto value = QVariant();
+        auto &range = option.mAllowedRange;
+        snapshot >> option.mName >> option.mTitle >> option.mDescription
+            >> flags >> type >> unit >> option.mAllowedValues
+            >> range.min >> range.max >> range.quantization
+            >> option.mValueCached >> value;
+        option.mFlags = flags;
+        option.mType = static_cast<Type>(type);
+        option.mUnit = static_cast<Unit>(unit);
+        option.mValue = option.fromVariant(value);
+        option.mValueKnown = option.mValueCached;
+        mOptions.append(option);
+    }
+
+    if (snapshot.status() != QDataStream::Ok) {
+        mOptions.clear();
+        return;
+    }
+    indexOptions();
 }
 
 QtSaneScanner::~QtSaneScanner()
 {
+    setDeviceThread(nullptr);
+
+    // wait for requests which are still processed on the device thread
+    auto lock = QMutexLocker(&mOptionMutex);
     if (mDeviceHandle)
         sane_close(mDeviceHandle);
 }
 
-QImage QtSaneScanner::startScan()
+void QtSaneScanner::setDeviceThread(QThread *thread)
+{
+    if (mDeviceContext && thread == mDeviceThread)
+        return;
+
+    // detach without waiting for the device thread, requests which
+    // were not processed yet are taken back
+    if (mDeviceContext) {
+        auto lock = QMutexLocker(&mDeviceContext->mutex);
+        mDeviceContext->scanner = nullptr;
+        const auto writes = std::exchange(mDeviceContext->writes, { });
+        const auto reads = std::exchange(mDeviceContext->reads, { });
+        lock.unlock();
+
+        if (mDeviceThread && mDeviceThread->isRunning())
+            mDeviceContext->deleteLater();
+        else
+            delete mDeviceContext;
+        mDeviceContext = nullptr;
+
+        // writes which were not superseded are deferred again
+        for (const auto &write : writes) {
+            auto &option = mOptions[write.index];
+            if (option.mWriteSequence.loadAcquire() == write.sequence)
+                option.setUnappliedValue(write.value);
+        }
+        for (auto index : reads)
+            mOptions[index].cancelValueRequest();
+    }
+
+    mDeviceThread = thread;
+    if (thread) {
+        mDeviceContext = new DeviceContext();
+        mDeviceContext->scanner = this;
+        mDeviceContext->moveToThread(thread);
+        if (mDeviceHandle && mUpdateDepth == 0)
+            postDeviceRequests(takeUnappliedWrites(), { });
+    }
+}
+
+void QtSaneScanner::writeSnapshot(QDataStream &snapshot) const
+{
+    // values which were not read yet are not stored
+    auto lock = QMutexLocker(&mValueMutex);
+    snapshot << snapshotVersion << static_cast<qint32>(mOptions.size());
+    for (const auto &option : mOptions) {
+        const auto &range = option.mAllowedRange;
+        snapshot << option.mName << option.mTitle << option.mDescription
+            << static_cast<quint32>(option.mFlags)
+            << static_cast<qint32>(option.mType)
+            << static_cast<qint32>(option.mUnit) << option.mAllowedValues
+            << range.min << range.max << range.quantization
+            << option.mValueCached << option.toVariant(option.mValue);
+    }
+}
+
+void QtSaneScanner::indexOptions()
 {
-    auto lock = QMutexLocker(&mMutex);
+    mOptionIndices.clear();
+    mOptionIndices.reserve(mOptions.size());
+    for (auto i = 0; i < mOptions.size(); ++i)
+        mOptionIndices.insert(mOptions[i].name(), i);
+}
+
+bool QtSaneScanner::startScan()
+{
+    auto lock = QMutexLocker(&mScanMutex);
     if (!mDeviceHandle || mScanning)
-        return { };
+        return false;
+
+    mScanStatistics = { };
+    mScanTimer.start();
+    mLastReadEndNsec = -1;
+    if (startFrame())
+        return true;
+
+    // end scan, also when the caller does not cancel it
+    const auto changes = endScan();
+    lock.unlock();
+    if (!changes.isEmpty())
+        Q_EMIT optionsChanged(changes);
+    return false;
+}
+
+bool QtSaneScanner::startNextPage()
+{
+    auto lock = QMutexLocker(&mScanMutex);
+    if (!mDeviceHandle || !mScanning || !mPageComplete)
+        return false;
+
+    // continue batch without cancelling, until feeder is empty
+    if (!startFrame(false)) {
+        const auto changes = endScan();
+        lock.unlock();
+        if (!changes.isEmpty())
+            Q_EMIT optionsChanged(changes);
+        return false;
+    }
+
+    // I/O mode has to be set again after each start
+    if (mNonBlocking)
+        mNonBlocking = enableNonBlockingIo();
+    return true;
+}
+
+bool QtSaneScanner::startFrame(bool reportNoDocuments)
+{
+    // wait for a pending option write, values set from now on are
+    // applied when the scan is cancelled
+    if (!mScanning) {
+        auto optionLock = QMutexLocker(&mOptionMutex);
+        mScanning = true;
+    }
+    mPageComplete = false;
+    mFrameEnded = false;
 
     auto result = sane_start(mDeviceHandle);
+    mOutOfDocuments = (result == SANE_STATUS_NO_DOCS);
     if (result != SANE_STATUS_GOOD) {
-        error(result, "starting scan");
-        return { };
+        if (!mOutOfDocuments || reportNoDocuments)
+            error(result, "starting scan");
+        return false;
     }
-    mScanning = true;
 
     auto parameters = SANE_Parameters{ };
     result = sane_get_parameters(mDeviceHandle, &parameters);
     if (result != SANE_STATUS_GOOD) {
         error(result, "getting scan parameters");
-        return { };
+        return false;
     }
+    if (mScanStatistics.frames++ == 0)
+        mScanStatistics.parametersUsec = mScanTimer.nsecsElapsed() / 1000;
 
-    mBytesPerLine = parameters.bytes_per_line;
+    mParameters = {
+        static_cast<Frame>(parameters.format),
+        (parameters.last_frame != SANE_FALSE),
+        parameters.bytes_per_line,
+        parameters.pixels_per_line,
+        parameters.lines,
+        parameters.depth,
+    };
+    ++mScanId;
+    return true;
+}
 
-    auto format = QImage::Format{ };
-    if (parameters.format == SANE_FRAME_RGB) {
-        switch (parameters.depth) {
-            case 8: format = QImage::Format_RGB888; break;
-            case 16: format = QImage::Format_RGBX64; break;
-        }
+bool QtSaneScanner::setNonBlocking(bool nonBlocking)
+{
+    auto lock = QMutexLocker(&mScanMutex);
+    if (!mDeviceHandle || !mScanning)
+        return false;
+
+    if (mNonBlocking == nonBlocking)
+        return true;
+
+    if (nonBlocking) {
+        mNonBlocking = enableNonBlockingIo();
+        return mNonBlocking;
+    }
+
+    mReadNotifier.reset();
+    check(sane_set_io_mode(mDeviceHandle, SANE_FALSE), "setting I/O mode");
+    mNonBlocking = false;
+    return true;
+}
+
+bool QtSaneScanner::enableNonBlockingIo()
+{
+    const auto checkSupported = [](SANE_Status result, const char *action) {
+        if (result != SANE_STATUS_UNSUPPORTED)
+            check(result, action);
+        return (result == SANE_STATUS_GOOD);
+    };
+
+    mReadNotifier.reset();
+    if (!checkSupported(sane_set_io_mode(mDeviceHandle, SANE_TRUE),
+            "setting I/O mode"))
+        return false;
+
+    auto fd = SANE_Int{ };
+    if (!checkSupported(sane_get_select_fd(mDeviceHandle, &fd),
+            "getting select file descriptor")) {
+        sane_set_io_mode(mDeviceHandle, SANE_FALSE);
+        return false;
     }
-    else {
-        switch (parameters.depth) {
-            case 1: format = QImage::Format_Mono; break;
-            case 8: format = QImage::Format_Grayscale8; break;
-            case 16: format = QImage::Format_Grayscale16; break;
+
+    // notifier lives in the reading thread
+    mReadNotifier.reset(new QSocketNotifier(fd, QSocketNotifier::Read));
+    connect(mReadNotifier.data(), &QSocketNotifier::activated,
+        this, &QtSaneScanner::scanDataAvailable, Qt::DirectConnection);
+    return true;
+}
+
+bool QtSaneScanner::readScanLines(ScanBuffer &buffer)
+{
+    // only the scan state is locked, so that options can be set meanwhile
+    auto lock = QMutexLocker(&mScanMutex);
+    if (!mDeviceHandle || !mScanning)
+        return false;
+
+    if (buffer.mScanId != mScanId)
+        buffer.reset(mScanId, mParameters);
+    else
+        buffer.discardLines();
+
+    if (mFrameEnded && !endFrame(buffer))
+        return false;
+
+    // in blocking mode read until at least one complete line is available,
+    // in non-blocking mode until no more data is available
+    for (;;) {
+        auto length = SANE_Int{ };
+        const auto begin = mScanTimer.nsecsElapsed();
+        if (mLastReadEndNsec >= 0)
+            recordGap(mScanStatistics, begin - mLastReadEndNsec);
+        const auto result = sane_read(mDeviceHandle,
+            reinterpret_cast<SANE_Byte*>(buffer.end()),
+            buffer.available(), &length);
+        mLastReadEndNsec = mScanTimer.nsecsElapsed();
+        recordRead(mScanStatistics, mLastReadEndNsec - begin,
+            mLastReadEndNsec / 1000, length);
+        if (result == SANE_STATUS_EOF) {
+            // deliver the complete lines first, the frame is ended on the
+            // next call, which no select descriptor would trigger
+            if (buffer.lineCount() > 0) {
+                mFrameEnded = true;
+                if (mNonBlocking)
+                    QMetaObject::invokeMethod(mReadNotifier.data(),
+                        [this]() { Q_EMIT scanDataAvailable(); },
+                        Qt::QueuedConnection);
+                break;
+            }
+            if (!endFrame(buffer))
+                return false;
+            continue;
+        }
+
+        if (result == SANE_STATUS_CANCELLED)
+            return false;
+
+        if (result != SANE_STATUS_GOOD) {
+            error(result, "reading lines");
+            return false;
         }
+        buffer.append(length);
+
+        if (mNonBlocking ? (!length || !buffer.available()) :
+                           buffer.lineCount() > 0)
+            break;
     }
-    if (format == QImage::Format_Invalid) {
-        error(result, "unsupported format");
-        return { };
+    return true;
+}
+
+bool QtSaneScanner::endFrame(ScanBuffer &buffer)
+{
+    mFrameEnded = false;
+    if (mParameters.lastFrame) {
+        mPageComplete = true;
+        return false;
     }
-    const auto size = QSize(parameters.pixels_per_line, parameters.lines);
-    return QImage(size, format);
+
+    // continue with next frame of a multi-frame scan
+    if (!startFrame())
+        return false;
+    if (mNonBlocking)
+        mNonBlocking = enableNonBlockingIo();
+    buffer.reset(mScanId, mParameters);
+    return true;
 }
 
-QByteArray QtSaneScanner::readScanLine()
+void QtSaneScanner::cancelScan()
 {
-    auto lock = QMutexLocker(&mMutex);
+    auto lock = QMutexLocker(&mScanMutex);
     if (!mDeviceHandle || !mScanning)
-        return { };
+        return;
 
-    auto length = SANE_Int{ };
-    auto rowData = QByteArray(mBytesPerLine, Qt::Uninitialized);
-    const auto result = sane_read(mDeviceHandle,
-        reinterpret_cast<SANE_Byte*>(rowData.data()), rowData.size(), &length);
-    if (result == SANE_STATUS_EOF || result == SANE_STATUS_CANCELLED)
-        return { };
+    const auto changes = endScan();
+    lock.unlock();
+    if (!changes.isEmpty())
+        Q_EMIT optionsChanged(changes);
+}
+
+auto QtSaneScanner::endScan() -> OptionChanges
+{
+    // called with the scan lock held
+    mPageComplete = false;
+    mFrameEnded = false;
+    mNonBlocking = false;
+    mReadNotifier.reset();
+    sane_cancel(mDeviceHandle);
 
-    check(result, "reading line");
-    return rowData;
+    // apply the option values which were set while scanning
+    auto optionLock = QMutexLocker(&mOptionMutex);
+    mScanning = false;
+    const auto changes = applyUnappliedOptionValues();
+    writeOptionValues(std::exchange(mDeferredWrites, { }),
+        std::exchange(mDeferredReads, { }));
+    return changes;
 }
 
-void QtSaneScanner::cancelScan()
+void QtSaneScanner::abortScan()
 {
-    auto lock = QMutexLocker(&mMutex);
-    if (mDeviceHandle && mScanning) {
-        mScanning = false;
+    // sane_cancel may be called asynchronously, the scan mutex is
+    // held by the blocked read
+    if (mDeviceHandle && mScanning)
         sane_cancel(mDeviceHandle);
-        if (applyUnappliedOptionValues()) {
-            lock.unlock();
-            Q_EMIT optionsChanged();
-        }
-    }
+}
+
+int QtSaneScanner::findOptionIndex(const QString &name) const
+{
+    return mOptionIndices.value(name, -1);
 }
 
 auto QtSaneScanner::findOption(const QString &name) const -> const Option*
 {
-    auto it = mOptionMap.find(name);
-    if (it != mOptionMap.end())
-        return it.value();
-    return nullptr;
+    const auto index = findOptionIndex(name);
+    return (index >= 0 ? &mOptions.at(index) : nullptr);
 }
 
 auto QtSaneScanner::findOption(const QString &name) -> Option*
@@ -283,57 +949,296 @@ auto QtSaneScanner::findOption(const QString &name) -> Option*
         static_cast<const QtSaneScanner*>(this)->findOption(name));
 }
 
-void QtSaneScanner::handleOptionValueChanged(int index)
+void QtSaneScanner::beginUpdate()
+{
+    mUpdateDepth.ref();
+}
+
+void QtSaneScanner::commitUpdate()
+{
+    if (mUpdateDepth.deref())
+        return;
+
+    if (isWritingAsync()) {
+        if (mDeviceHandle)
+            postDeviceRequests(takeUnappliedWrites(), { });
+        return;
+    }
+
+    auto lock = QMutexLocker(&mOptionMutex);
+    if (!mDeviceHandle || mScanning || mUpdateDepth > 0)
+        return;
+
+    const auto changes = applyUnappliedOptionValues();
+    lock.unlock();
+    if (!changes.isEmpty())
+        Q_EMIT optionsChanged(changes);
+}
+
+void QtSaneScanner::handleOptionValueChanged(int index, Value value)
 {
-    auto lock = QMutexLocker(&mMutex);
     auto &option = mOptions[index];
-    if (!mDeviceHandle || mScanning) {
-        option.setHasUnappliedValue();
+    const auto sequence = option.mWriteSequence.fetchAndAddOrdered(1) + 1;
+
+    // write on device thread, the set value is kept until it was applied
+    if (isWritingAsync()) {
+        if (!mDeviceHandle || mUpdateDepth > 0)
+            option.setUnappliedValue(std::move(value));
+        else
+            postDeviceRequests({ { index, std::move(value), sequence } }, { });
         return;
     }
 
-    auto reloadOptions = false;
-    setOptionValue(index, &reloadOptions);
-    if (reloadOptions) {
-        updateAllOptions();
-        lock.unlock();
-        Q_EMIT optionsChanged();
+    // defer without waiting while scanning, unless scan was just cancelled
+    if (mScanning) {
+        option.setUnappliedValue(value);
+        if (mScanning)
+            return;
     }
-    else {
-        lock.unlock();
-        Q_EMIT optionChanged(option);
+
+    auto lock = QMutexLocker(&mOptionMutex);
+    // defer while scanning or within a transaction
+    if (!mDeviceHandle || mScanning || mUpdateDepth > 0) {
+        option.setUnappliedValue(std::move(value));
+        return;
     }
+
+    // the set value supersedes one which is still pending
+    auto pending = Value{ };
+    option.takeUnappliedValue(&pending);
+    if (!isOwningThread())
+        return writeOptionValues({ { index, std::move(value), sequence } }, { });
+
+    auto reloadOptions = false;
+    setOptionValue(index, value, &reloadOptions);
+    auto changes = OptionChanges{ { index } };
+    if (reloadOptions)
+        updateAllOptions(changes);
+    lock.unlock();
+    Q_EMIT optionsChanged(changes);
 }
 
-bool QtSaneScanner::applyUnappliedOptionValues()
+auto QtSaneScanner::applyUnappliedOptionValues() -> OptionChanges
 {
-    auto valueApplied = false;
+    // changes are handed over when not on the owning thread
+    if (!isOwningThread()) {
+        writeOptionValues(takeUnappliedWrites(), { });
+        return { };
+    }
+
+    // backends order options by their dependencies, reloading of
+    // all options is done once after all values were applied
+    auto changes = OptionChanges{ };
     auto reloadOptions = false;
+    auto value = Value{ };
     for (auto i = 0; i < mOptions.size(); ++i)
-        if (mOptions[i].hasUnappliedValue()) {
-            setOptionValue(i, &reloadOptions);
-            mOptions[i].clearHasUnappliedValue();
-            valueApplied = true;
+        if (mOptions[i].takeUnappliedValue(&value)) {
+            setOptionValue(i, value, &reloadOptions);
+            changes.indices.append(i);
         }
 
     if (reloadOptions)
-        updateAllOptions();
+        updateAllOptions(changes);
 
-    return valueApplied;
+    return changes;
 }
 
-void QtSaneScanner::updateAllOptions()
+bool QtSaneScanner::isOwningThread() const
 {
-    for (auto i = 0; i < mOptions.size(); ++i)
-        mOptions[i].update(*mOptionDescriptors[i]);
+    // options are only updated on the thread the scanner lives in
+    return (QThread::currentThread() == thread());
+}
+
+bool QtSaneScanner::isWritingAsync() const
+{
+    return (mDeviceContext && mDeviceThread && mDeviceThread->isRunning() &&
+            mDeviceThread != QThread::currentThread());
 }
 
-void QtSaneScanner::setOptionValue(int index, bool *reloadOptions)
+auto QtSaneScanner::takeUnappliedWrites() -> QList<OptionWrite>
+{
+    auto writes = QList<OptionWrite>();
+    auto value = Value{ };
+    for (auto i = 0; i < mOptions.size(); ++i) {
+        auto &option = mOptions[i];
+        if (option.takeUnappliedValue(&value))
+            writes.append({ i, std::move(value),
+                option.mWriteSequence.loadAcquire() });
+    }
+    return writes;
+}
+
+void QtSaneScanner::postDeviceRequests(QList<OptionWrite> writes,
+    QVector<int> reads)
+{
+    if (writes.isEmpty() && reads.isEmpty())
+        return;
+
+    // a single pending invocation processes all queued requests
+    const auto context = mDeviceContext;
+    auto lock = QMutexLocker(&context->mutex);
+    const auto idle = (context->writes.isEmpty() && context->reads.isEmpty());
+    context->writes += writes;
+    context->reads += reads;
+    lock.unlock();
+    if (idle)
+        QMetaObject::invokeMethod(context,
+            [context]() { processDeviceRequests(context); },
+            Qt::QueuedConnection);
+}
+
+void QtSaneScanner::processDeviceRequests(DeviceContext *context)
+{
+    auto lock = QMutexLocker(&context->mutex);
+    const auto scanner = context->scanner;
+    if (!scanner)
+        return;
+    const auto writes = std::exchange(context->writes, { });
+    const auto reads = std::exchange(context->reads, { });
+
+    // option lock is taken before the scanner can be detached,
+    // so it is not destroyed while the requests are processed
+    auto optionLock = QMutexLocker(&scanner->mOptionMutex);
+    lock.unlock();
+    scanner->writeOptionValues(writes, reads);
+}
+
+void QtSaneScanner::writeOptionValues(const QList<OptionWrite> &writes,
+    const QVector<int> &reads)
+{
+    // defer while scanning, option lock is held
+    if (mScanning) {
+        mDeferredWrites += writes;
+        mDeferredReads += reads;
+        return;
+    }
+
+    auto written = QVector<int>();
+    auto inexact = QVector<int>();
+    auto reloadOptions = false;
+    for (const auto &write : writes) {
+        // skip when a newer value is already on its way
+        if (mOptions.at(write.index).mWriteSequence.loadAcquire() !=
+                write.sequence)
+            continue;
+
+        const auto info = writeOptionValue(write.index, write.value);
+        if (info & SANE_INFO_RELOAD_OPTIONS)
+            reloadOptions = true;
+        else if (info & SANE_INFO_INEXACT)
+            inexact.append(write.index);
+        written.append(write.index);
+    }
+
+    // descriptors and the values which are in use are read here,
+    // so the owning thread never has to call the device
+    auto optionReads = QList<OptionRead>();
+    for (auto i = 0; i < mOptions.size(); ++i) {
+        const auto requested = reads.contains(i);
+        const auto reload = (reloadOptions || inexact.contains(i));
+        if (requested || reload)
+            optionReads.append(readOption(i, reload,
+                requested || mOptions.at(i).isValueCached()));
+
+        // this thread reads the changed values again from the device
+        if (reload)
+            mOptions[i].invalidateAppliedValue();
+    }
+
+    if (!written.isEmpty() || !optionReads.isEmpty())
+        QMetaObject::invokeMethod(this, [this, written, optionReads]() {
+            handleOptionsRead(written, optionReads);
+        }, Qt::QueuedConnection);
+}
+
+auto QtSaneScanner::readOption(int index, bool descriptor, bool value)
+    -> OptionRead
+{
+    const auto &desc = *mOptionDescriptors[index];
+    auto read = OptionRead{ index,
+        mOptions.at(index).mWriteSequence.loadAcquire(),
+        descriptor, Option(this, index), false, { } };
+    if (descriptor) {
+        read.descriptor.mFingerprint = getFingerprint(desc);
+        read.descriptor.readDescriptor(desc);
+    }
+    if (value && SANE_OPTION_IS_ACTIVE(desc.cap)) {
+        read.value = getOptionValue(index);
+        read.hasValue = true;
+    }
+    return read;
+}
+
+void QtSaneScanner::handleOptionsRead(const QVector<int> &written,
+    const QList<OptionRead> &reads)
+{
+    // applied without the option lock, the device thread is not waited for
+    auto changes = OptionChanges{ };
+    for (auto index : written)
+        changes.insert(index);
+
+    for (const auto &read : reads) {
+        auto &option = mOptions[read.index];
+        if (read.hasDescriptor && option.update(read.descriptor)) {
+            changes.insert(read.index);
+            changes.descriptorsChanged = true;
+        }
+        if (read.hasValue) {
+            if (option.cacheReadValue(read.value, read.sequence))
+                changes.insert(read.index);
+        }
+        else {
+            option.cancelValueRequest();
+            if (read.hasDescriptor && option.isActive() &&
+                option.invalidateAppliedValue())
+                changes.insert(read.index);
+        }
+    }
+    if (!changes.isEmpty())
+        Q_EMIT optionsChanged(changes);
+}
+
+void QtSaneScanner::updateAllOptions(OptionChanges &changes)
+{
+    Q_ASSERT(isOwningThread());
+    // options with unchanged descriptors are not rebuilt, but their values
+    // may have changed too, so they are read again when requested
+    for (auto i = 0; i < mOptions.size(); ++i) {
+        auto &option = mOptions[i];
+        if (option.update(*mOptionDescriptors[i])) {
+            changes.insert(i);
+            changes.descriptorsChanged = true;
+        }
+        else if (option.isActive() && option.invalidateAppliedValue()) {
+            changes.insert(i);
+        }
+    }
+}
+
+void QtSaneScanner::setOptionValue(int index, const Value &value,
+    bool *reloadOptions)
+{
+    // other threads write through writeOptionValues
+    Q_ASSERT(isOwningThread());
+    auto &option = mOptions[index];
+    const auto info = writeOptionValue(index, value);
+    if (info & SANE_INFO_RELOAD_OPTIONS) {
+        // reload all options when they are affected
+        *reloadOptions = true;
+    }
+    else if (info & SANE_INFO_INEXACT) {
+        // reload only this option when value could not be applied exactly
+        option.invalidateValue();
+        option.update(*mOptionDescriptors[index]);
+    }
+}
+
+int QtSaneScanner::writeOptionValue(int index, const Value &value)
 {
     const auto &desc = *mOptionDescriptors[index];
     if (!SANE_OPTION_IS_ACTIVE(desc.cap) ||
         !SANE_OPTION_IS_SETTABLE(desc.cap))
-        return;
+        return 0;
 
     auto info = SANE_Int{ };
     const auto setData = [&](const void *value) {
@@ -342,31 +1247,29 @@ void QtSaneScanner::setOptionValue(int index, bool *reloadOptions)
             const_cast<void*>(value), &info),
             "setting option", desc.name);
     };
-    const auto setValue = [&](const auto &value) {
-        setData(&value);
-    };
 
-    auto &option = mOptions[index];                
-    const auto &value = option.value();
     switch (desc.type) {
         case SANE_TYPE_BOOL:
-            if (desc.size == sizeof(SANE_Bool))
-                setValue(SANE_Bool{ value.toBool() });
-            break;
-
         case SANE_TYPE_INT:
-            if (desc.size == sizeof(SANE_Int))
-                setValue(SANE_Int{ value.toInt() });
-            break;
-
         case SANE_TYPE_FIXED:
-            if (desc.size == sizeof(SANE_Fixed))
-                setValue(SANE_Fixed{ SANE_FIX(value.toDouble()) });
+            if (desc.size == sizeof(SANE_Word)) {
+                auto word = SANE_Word{ value.word };
+                setData(&word);
+            }
+            else if (!value.words.isEmpty()) {
+                // backend reads and may write back the whole list
+                auto words = value.words;
+                words.resize(desc.size / static_cast<int>(sizeof(SANE_Word)));
+                setData(words.data());
+            }
             break;
 
         case SANE_TYPE_STRING: {
-            auto buffer = QByteArray();
-            buffer = value.toString().toUtf8();
+            // backend may write back the applied value
+            auto buffer = QByteArray(std::max(desc.size,
+                value.string.size() + 1), '\0');
+            std::memcpy(buffer.data(), value.string.constData(),
+                static_cast<size_t>(value.string.size()));
             setData(buffer.data());
             break;
         }
@@ -375,19 +1278,45 @@ void QtSaneScanner::setOptionValue(int index, bool *reloadOptions)
         case SANE_TYPE_BUTTON:
             break;
     }
+    return info;
+}
 
-    if (info & SANE_INFO_RELOAD_OPTIONS) {
-        // reload all options when they are affected
-        *reloadOptions = true;
+auto QtSaneScanner::currentDescriptor(const Option &option) const -> Option
+{
+    // options are only updated on the owning thread,
+    // other threads read the descriptor from the device
+    auto descriptor = Option(const_cast<QtSaneScanner*>(this), option.mIndex);
+    if (isOwningThread() || !mDeviceHandle) {
+        descriptor.assignDescriptor(option);
+        return descriptor;
     }
-    else if (info & SANE_INFO_INEXACT) {
-        // reload only this option when value could not be applied exactly
-        option.update(desc);
+    auto lock = QMutexLocker(&mOptionMutex);
+    descriptor.readDescriptor(*mOptionDescriptors[option.mIndex]);
+    return descriptor;
+}
+
+void QtSaneScanner::fetchOptionValue(int index)
+{
+    // read on device thread, last known value is kept until it arrives
+    if (isWritingAsync()) {
+        if (mDeviceHandle && mOptions[index].requestValue())
+            postDeviceRequests({ }, { index });
+        return;
     }
+
+    // keep last known value while scanning
+    auto lock = QMutexLocker(&mOptionMutex);
+    if (!mDeviceHandle || mScanning)
+        return;
+
+    auto &option = mOptions[index];
+    if (!option.isValueCached())
+        option.cacheValue(getOptionValue(index));
 }
 
-QVariant QtSaneScanner::getOptionValue(int index) const
+auto QtSaneScanner::getOptionValue(int index) -> Value
 {
+    ++mOptionStatistics.valueGets;
     const auto &desc = *mOptionDescriptors[index];
 
     const auto getData = [&](void *value) {
@@ -395,56 +1324,31 @@ QVariant QtSaneScanner::getOptionValue(int index) const
             SANE_ACTION_GET_VALUE, value, nullptr),
             "getting option", desc.name);
     };
-    const auto getBuffer = [&]() {
-        auto buffer = QByteArray(desc.size, Qt::Uninitialized);
-        getData(buffer.data());
-        return buffer;
-    };
 
+    auto value = Value{ };
     switch (desc.type) {
-        case SANE_TYPE_BOOL: {
-            if (desc.size == sizeof(SANE_Bool)) {
-                auto value = SANE_Bool{ };
-                getData(&value);
-                return static_cast<bool>(value);
-            }
-            return { };
-        }
-
-        case SANE_TYPE_INT: {
-            if (desc.size == sizeof(SANE_Int)) {
-                auto value = SANE_Int{ };
-                getData(&value);
-                return value;
-            }
-            else {
-                const auto buffer = getBuffer();
-                auto list = QVariantList();
-                for (auto i = 0; i < desc.size; i += sizeof(SANE_Int))
-                    list << *reinterpret_cast<const SANE_Int*>(buffer.data() + i);
-                return list;
-            }
-        }
-
-        case SANE_TYPE_FIXED: {
-            if (desc.size == sizeof(SANE_Fixed)) {
-                auto value = SANE_Fixed{ };
-                getData(&value);
-                return SANE_UNFIX(value);
+        case SANE_TYPE_BOOL:
+        case SANE_TYPE_INT:
+        case SANE_TYPE_FIXED:
+            if (desc.size == sizeof(SANE_Word)) {
+                getData(&value.word);
             }
             else {
-                const auto buffer = getBuffer();
-                auto list = QVariantList();
-                for (auto i = 0; i < desc.size; i += sizeof(SANE_Fixed))
-                    list << SANE_UNFIX(*reinterpret_cast<const SANE_Fixed*>(buffer.data() + i));
-                return list;
+                // lists are read at once into a contiguous array
+                value.words.resize(desc.size / static_cast<int>(sizeof(SANE_Word)));
+                getData(value.words.data());
             }
-        }
+            break;
 
         case SANE_TYPE_STRING:
-            return QString::fromUtf8(getBuffer());
+            value.string = QByteArray(desc.size, Qt::Uninitialized);
+            getData(value.string.data());
+            value.string.truncate(qstrnlen(value.string.constData(),
+                static_cast<uint>(value.string.size())));
+            break;
 
         default:
-            return { };
+            break;
     }
+    return value;
 }
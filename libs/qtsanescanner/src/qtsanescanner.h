@@ -2,10 +2,19 @@
 
 #include <QString>
 #include <QList>
-#include <QMap>
+#include <QHash>
+#include <QVector>
 #include <QMutex>
+#include <QAtomicInt>
 #include <QVariant>
-#include <QImage>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QThread>
+#include <algorithm>
+#include <array>
+
+class QSocketNotifier;
+class QDataStream;
 
 class QtSaneScanner : public QObject
 {
@@ -29,7 +38,6 @@ public:
         Automatic = (1 << 4),
         Inactive = (1 << 5),
         Advanced = (1 << 6),
-        HasUnappliedValue = (1 << 10),
     };
 
     enum class Type
@@ -45,6 +53,16 @@ public:
         ValueList,
     };
 
+    enum class Frame
+    {
+        Gray,
+        RGB,
+        Red,
+        Green,
+        Blue,
+    };
+    Q_ENUM(Frame)
+
     enum class Unit
     {
         None,
@@ -63,6 +81,94 @@ public:
         double quantization;
     };
 
+    struct Parameters
+    {
+        Frame frame;
+        bool lastFrame;
+        int bytesPerLine;
+        int pixelsPerLine;
+        int lines;
+        int depth;
+    };
+
+    struct OptionStatistics
+    {
+        // values read from the backend
+        int valueGets;
+        // values an eager update of all options would have read
+        int eagerValueGets;
+        // descriptors which were compared and which actually changed
+        int descriptorUpdates;
+        int descriptorChanges;
+
+        int avoidedValueGets() const { return eagerValueGets - valueGets; }
+    };
+
+    struct ScanStatistics
+    {
+        // bucket n counts reads which took less than 2^n microseconds
+        static constexpr int LatencyBuckets = 24;
+
+        // microseconds since first start, -1 when not reached
+        qint64 parametersUsec{ -1 };
+        qint64 firstByteUsec{ -1 };
+        qint64 lastByteUsec{ -1 };
+        int frames{ };
+        int reads{ };
+        int emptyReads{ };
+        qint64 bytesRead{ };
+        int maxBytesPerRead{ };
+        // time spent in and between reads
+        qint64 readUsec{ };
+        qint64 gapUsec{ };
+        qint64 maxGapUsec{ };
+        std::array<int, LatencyBuckets> readLatencies{ };
+
+        double bytesPerRead() const {
+            return (reads ? static_cast<double>(bytesRead) / reads : 0.0);
+        }
+        // sustained throughput in bytes per second
+        double throughput() const {
+            const auto usec = lastByteUsec - firstByteUsec;
+            return (usec > 0 ? bytesRead * 1000000.0 / usec : 0.0);
+        }
+    };
+
+    // sorted indices of options whose values or descriptors changed,
+    // after a reload all active options are considered changed
+    struct OptionChanges
+    {
+        QVector<int> indices;
+        bool descriptorsChanged{ };
+
+        bool isEmpty() const { return indices.isEmpty(); }
+        bool contains(int index) const {
+            return std::binary_search(indices.begin(), indices.end(), index);
+        }
+        void insert(int index) {
+            const auto it = std::lower_bound(indices.begin(), indices.end(), index);
+            if (it == indices.end() || *it != index)
+                indices.insert(it, index);
+        }
+    };
+
+    // value as it is exchanged with the backend
+    struct Value
+    {
+        // bool, int or fixed point
+        int word{ };
+        // utf-8 without terminating zero
+        QByteArray string;
+        // words of lists, in the representation of the single values
+        QVector<int> words;
+
+        bool operator==(const Value &other) const {
+            return (word == other.word && string == other.string &&
+                    words == other.words);
+        }
+        bool operator!=(const Value &other) const { return !(*this == other); }
+    };
+
     class Option
     {
     public:
@@ -79,59 +185,237 @@ public:
         Type type() const { return mType; }
         const QList<QVariant> &allowedValues() const { return mAllowedValues; }
         const Range &allowedRange() const { return mAllowedRange; }
-        const QVariant &value() const { return mValue; }
+        // while writing asynchronously values are read on the device thread,
+        // the last known value is returned until optionsChanged reports it,
+        // value() is invalid when none is known yet
+        QVariant value() const;
         void setValue(const QVariant &value);
+        bool boolValue() const;
+        int intValue() const;
+        double doubleValue() const;
+        int fixedValue() const;
+        QByteArray stringValue() const;
+        QVector<int> listValue() const;
+        void setBoolValue(bool value);
+        void setIntValue(int value);
+        void setDoubleValue(double value);
+        void setFixedValue(int value);
+        void setStringValue(const QByteArray &value);
+        void setListValue(QVector<int> value);
 
     private:
         friend class QtSaneScanner;
-        void update(const OptionDescriptor &descriptor);
-        void setHasUnappliedValue() { mFlags |= HasUnappliedValue; }
-        void clearHasUnappliedValue() { mFlags &= ~HasUnappliedValue; }
-        bool hasUnappliedValue() { return (mFlags & HasUnappliedValue) != 0; }
+        Option(QtSaneScanner *scanner, int optionIndex);
+        bool update(const OptionDescriptor &descriptor);
+        bool update(const Option &read);
+        bool updateFingerprint(size_t fingerprint, bool active);
+        void readDescriptor(const OptionDescriptor &descriptor);
+        void assignDescriptor(const Option &other);
+        Value typedValue() const;
+        bool readValue(Value *value) const;
+        void setTypedValue(Value value);
+        Value fromVariant(const QVariant &value) const;
+        QVariant toVariant(const Value &value) const;
+        // values are exchanged between threads under the value lock
+        bool isValueCached() const;
+        void cacheValue(Value value);
+        bool cacheReadValue(Value value, int sequence);
+        bool requestValue();
+        void cancelValueRequest();
+        void invalidateValue();
+        bool invalidateAppliedValue();
+        // set by the thread setting the value, also while scanning
+        void setUnappliedValue(Value value);
+        bool takeUnappliedValue(Value *value);
 
         QtSaneScanner *mScanner{ };
         int mIndex{ };
         QString mName;
         QString mTitle;
         QString mDescription;
-        unsigned int mFlags;
+        unsigned int mFlags{ };
         Type mType{ };
         Unit mUnit{ };
         QList<QVariant> mAllowedValues;
-        Range mAllowedRange;
-        QVariant mValue;
+        Range mAllowedRange{ };
+        size_t mFingerprint{ };
+        // last known value, which is kept while it is read again
+        Value mValue;
+        bool mValueCached{ };
+        bool mValueKnown{ };
+        bool mValueRequested{ };
+        Value mUnappliedValue;
+        bool mHasUnappliedValue{ };
+        // incremented by each set, to skip writes which were superseded
+        QAtomicInt mWriteSequence;
     };
 
-    static QList<DeviceInfo> initialize();
+    class ScanBuffer
+    {
+    public:
+        static constexpr int DefaultBlockSize = 256 * 1024;
+
+        explicit ScanBuffer(int blockSize = DefaultBlockSize);
+
+        int blockSize() const { return mBlockSize; }
+        int bytesPerLine() const { return mBytesPerLine; }
+        Frame frame() const { return mFrame; }
+        int lineCount() const { return mLineCount; }
+        const char *lines() const { return mData.constData(); }
+        const char *line(int index) const {
+            return mData.constData() + index * mBytesPerLine;
+        }
+
+    private:
+        friend class QtSaneScanner;
+        void reset(int scanId, const Parameters &parameters);
+        void discardLines();
+        char *end() { return mData.data() + mSize; }
+        int available() const { return mData.size() - mSize; }
+        void append(int length);
+
+        QByteArray mData;
+        int mBlockSize{ };
+        int mScanId{ -1 };
+        int mBytesPerLine{ };
+        Frame mFrame{ };
+        int mLineCount{ };
+        int mSize{ };
+    };
+
+    class Transaction
+    {
+    public:
+        explicit Transaction(QtSaneScanner *scanner)
+            : mScanner(*scanner) { mScanner.beginUpdate(); }
+        ~Transaction() { mScanner.commitUpdate(); }
+        Transaction(const Transaction&) = delete;
+        Transaction &operator=(const Transaction&) = delete;
+
+    private:
+        QtSaneScanner &mScanner;
+    };
+
+    static bool initialize();
+    static QList<DeviceInfo> getDevices();
     static void shutdown();
 
     explicit QtSaneScanner(const QString &deviceName);
+    QtSaneScanner(const QString &deviceName, QDataStream &snapshot);
     ~QtSaneScanner();
+    const QString &deviceName() const { return mDeviceName; }
+    void setDeviceThread(QThread *thread);
     bool isOpened() const { return (mDeviceHandle != nullptr); }
+    bool isScanning() const { return (mScanning != 0); }
+    void writeSnapshot(QDataStream &snapshot) const;
     const QList<Option> &options() const { return mOptions; }
+    Option &option(int index) { return mOptions[index]; }
+    const Option &option(int index) const { return mOptions.at(index); }
+    int findOptionIndex(const QString &name) const;
     Option* findOption(const QString &name);
     const Option* findOption(const QString &name) const;
-    QImage startScan();
-    QByteArray readScanLine();
+    // options are only updated on the owning thread, other threads
+    // get a copy of the descriptor as it is currently reported by the device
+    Option currentDescriptor(const Option &option) const;
+    const OptionStatistics &optionStatistics() const { return mOptionStatistics; }
+    const ScanStatistics &scanStatistics() const { return mScanStatistics; }
+    void beginUpdate();
+    void commitUpdate();
+    bool startScan();
+    bool startNextPage();
+    bool isPageComplete() const { return mPageComplete; }
+    // last start failed, because the feeder was empty
+    bool isOutOfDocuments() const { return mOutOfDocuments; }
+    const Parameters &parameters() const { return mParameters; }
+    bool setNonBlocking(bool nonBlocking);
+    bool isNonBlocking() const { return mNonBlocking; }
+    bool readScanLines(ScanBuffer &buffer);
     void cancelScan();
+    // can be called from another thread, to unblock a hanging read
+    void abortScan();
 
 Q_SIGNALS:
-    void optionChanged(const QtSaneScanner::Option &option);
-    void optionsChanged();
+    void optionsChanged(const QtSaneScanner::OptionChanges &changes);
+    void scanDataAvailable();
 
 private:
-    void handleOptionValueChanged(int index);
-    bool applyUnappliedOptionValues();
-    void updateAllOptions();
-    void setOptionValue(int index, bool *reloadOptions);
-    QVariant getOptionValue(int index) const;
+    class DeviceContext;
+
+    struct OptionWrite
+    {
+        int index;
+        Value value;
+        int sequence;
+    };
+
+    // descriptor and value read on the device thread,
+    // which are handed back to the thread owning the options
+    struct OptionRead
+    {
+        int index;
+        int sequence;
+        bool hasDescriptor;
+        Option descriptor;
+        bool hasValue;
+        Value value;
+    };
+
+    void indexOptions();
+    bool startFrame(bool reportNoDocuments = true);
+    bool endFrame(ScanBuffer &buffer);
+    OptionChanges endScan();
+    bool enableNonBlockingIo();
+    void handleOptionValueChanged(int index, Value value);
+    OptionChanges applyUnappliedOptionValues();
+    void updateAllOptions(OptionChanges &changes);
+    void setOptionValue(int index, const Value &value, bool *reloadOptions);
+    int writeOptionValue(int index, const Value &value);
+    bool isOwningThread() const;
+    bool isWritingAsync() const;
+    QList<OptionWrite> takeUnappliedWrites();
+    void postDeviceRequests(QList<OptionWrite> writes, QVector<int> reads);
+    static void processDeviceRequests(DeviceContext *context);
+    void writeOptionValues(const QList<OptionWrite> &writes,
+        const QVector<int> &reads);
+    OptionRead readOption(int index, bool descriptor, bool value);
+    void handleOptionsRead(const QVector<int> &written,
+        const QList<OptionRead> &reads);
+    void fetchOptionValue(int index);
+    Value getOptionValue(int index);
 
     static int sSaneVersionCode;
+    QString mDeviceName;
     void* mDeviceHandle{ };
     QList<Option> mOptions;
     QList<const OptionDescriptor*> mOptionDescriptors;
-    QMap<QString, Option*> mOptionMap;
-    QMutex mMutex;
-    bool mScanning{ };
-    int mBytesPerLine{ };
+    QHash<QString, int> mOptionIndices;
+    // guards the scan state, option values set during a scan are kept
+    // under the value lock and applied when the scan ends
+    QMutex mScanMutex;
+    mutable QMutex mOptionMutex;
+    // guards the option values, it is never held during device calls
+    mutable QMutex mValueMutex;
+    OptionStatistics mOptionStatistics{ };
+    ScanStatistics mScanStatistics;
+    QElapsedTimer mScanTimer;
+    qint64 mLastReadEndNsec{ -1 };
+    QAtomicInt mScanning;
+    bool mPageComplete{ };
+    bool mOutOfDocuments{ };
+    // end of frame, which was read after lines still to be delivered
+    bool mFrameEnded{ };
+    QAtomicInt mUpdateDepth;
+    // option writes of other threads are applied on the device thread
+    QPointer<QThread> mDeviceThread;
+    DeviceContext *mDeviceContext{ };
+    QList<OptionWrite> mDeferredWrites;
+    QVector<int> mDeferredReads;
+    bool mNonBlocking{ };
+    QScopedPointer<QSocketNotifier> mReadNotifier;
+    int mScanId{ };
+    Parameters mParameters{ };
 };
+
+Q_DECLARE_METATYPE(QtSaneScanner::DeviceInfo)
+Q_DECLARE_METATYPE(QtSaneScanner::ScanStatistics)
+Q_DECLARE_METATYPE(QtSaneScanner::OptionChanges)
@@ -0,0 +1,286 @@
+#include "DeviceDiscovery.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <algorithm>
+
+namespace
+{
+    // backends which do not answer in time are not listed
+    const auto backendTimeoutMs = 10000;
+
+    QString getSaneConfigDir()
+    {
+        auto dirs = qEnvironmentVariable("SANE_CONFIG_DIR").split(
+            QLatin1Char(':'), Qt::SkipEmptyParts);
+        dirs << QStringLiteral("/etc/sane.d")
+             << QStringLiteral("/usr/local/etc/sane.d");
+        for (const auto &dir : qAsConst(dirs))
+            if (QFile::exists(dir + QStringLiteral("/dll.conf")))
+                return dir;
+        return { };
+    }
+
+    void readBackends(const QString &fileName, QStringList &backends)
+    {
+        auto file = QFile(fileName);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+            return;
+
+        while (!file.atEnd()) {
+            auto line = QString::fromUtf8(file.readLine());
+            line.truncate(line.indexOf(QLatin1Char('#')));
+            line = line.trimmed();
+            if (!line.isEmpty() && !backends.contains(line))
+                backends << line;
+        }
+    }
+
+    QStringList getBackends(const QString &configDir)
+    {
+        auto backends = QStringList();
+        readBackends(configDir + QStringLiteral("/dll.conf"), backends);
+        const auto dllDir = QDir(configDir + QStringLiteral("/dll.d"));
+        for (const auto &entry : dllDir.entryInfoList(QDir::Files, QDir::Name))
+            readBackends(entry.absoluteFilePath(), backends);
+        return backends;
+    }
+
+    // configuration which only loads a single backend
+    bool writeProbeConfig(const QString &configDir, const QString &backend,
+        const QString &probeDir)
+    {
+        const auto dllConf = QStringLiteral("dll.conf");
+        for (const auto &entry : QDir(configDir).entryInfoList(QDir::Files))
+            if (entry.fileName() != dllConf)
+                QFile::link(entry.absoluteFilePath(),
+                    probeDir + QLatin1Char('/') + entry.fileName());
+
+        auto file = QFile(probeDir + QLatin1Char('/') + dllConf);
+        return (file.open(QIODevice::WriteOnly | QIODevice::Text) &&
+                file.write(backend.toUtf8() + '\n') > 0);
+    }
+
+    void abortProbe(QProcess *process, QObject *receiver)
+    {
+        // deleting a running process would wait for it to finish
+        process->disconnect(receiver);
+        process->kill();
+        process->deleteLater();
+    }
+} // namespace
+
+class DiscoveryWorker final : public QObject
+{
+    Q_OBJECT
+
+public:
+    using DeviceInfo = QtSaneScanner::DeviceInfo;
+
+public Q_SLOTS:
+    void stop() noexcept
+    {
+        abortProbes();
+        QThread::currentThread()->exit(0);
+    }
+
+    void refresh() noexcept
+    {
+        // abort probes of previous refresh
+        abortProbes();
+        mDevices.clear();
+
+        // backends are probed in parallel by helper processes, so slow
+        // network backends do not delay the local devices
+        const auto configDir = getSaneConfigDir();
+        const auto backends = getBackends(configDir);
+        for (const auto &backend : backends)
+            startProbe(configDir, backend);
+
+        // list devices in process, when backends could not be probed
+        if (mProbes.isEmpty())
+            Q_EMIT probingUnavailable();
+    }
+
+Q_SIGNALS:
+    void probingUnavailable();
+    void devicesDiscovered(QList<QtSaneScanner::DeviceInfo> devices);
+
+private:
+    void abortProbes()
+    {
+        for (auto process : qAsConst(mProbes))
+            abortProbe(process, this);
+        mProbes.clear();
+    }
+
+    void startProbe(const QString &configDir, const QString &backend)
+    {
+        auto probeDir = new QTemporaryDir();
+        if (!probeDir->isValid() ||
+            !writeProbeConfig(configDir, backend, probeDir->path())) {
+            delete probeDir;
+            return;
+        }
+
+        auto process = new QProcess(this);
+        connect(process, &QObject::destroyed, [probeDir]() { delete probeDir; });
+        connect(process, &QProcess::finished,
+            this, [this, process]() { handleProbeFinished(process); });
+        connect(process, &QProcess::errorOccurred, this,
+            [this, process](QProcess::ProcessError error) {
+                if (error == QProcess::FailedToStart)
+                    handleProbeFinished(process);
+            });
+        QTimer::singleShot(backendTimeoutMs, process, &QProcess::kill);
+
+        auto environment = QProcessEnvironment::systemEnvironment();
+        environment.insert(QStringLiteral("SANE_CONFIG_DIR"), probeDir->path());
+        process->setProcessEnvironment(environment);
+        process->setStandardErrorFile(QProcess::nullDevice());
+        process->start(QCoreApplication::applicationFilePath(),
+            { QString::fromLatin1(DeviceDiscovery::HelperArgument) });
+        mProbes.append(process);
+    }
+
+    void handleProbeFinished(QProcess *process)
+    {
+        if (!mProbes.removeOne(process))
+            return;
+
+        // merge devices as soon as each backend answered
+        auto devicesAdded = false;
+        if (process->exitStatus() == QProcess::NormalExit) {
+            const auto lines = process->readAllStandardOutput().split('\n');
+            for (const auto &line : lines) {
+                const auto fields = QString::fromUtf8(line).split(QLatin1Char('\t'));
+                if (fields.size() != 4 || std::any_of(mDevices.begin(), mDevices.end(),
+                        [&](const auto &device) { return device.name == fields[0]; }))
+                    continue;
+                mDevices += DeviceInfo{ fields[0], fields[1], fields[2], fields[3] };
+                devicesAdded = true;
+            }
+        }
+        process->deleteLater();
+
+        if (devicesAdded || mProbes.isEmpty())
+            Q_EMIT devicesDiscovered(mDevices);
+    }
+
+    QList<QProcess*> mProbes;
+    QList<DeviceInfo> mDevices;
+};
+
+// devices are opened on a thread of their own, so a slow sane_open
+// does not delay the discovery
+class OpenWorker final : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit OpenWorker(QThread *ownerThread)
+        : mOwnerThread(ownerThread)
+    {
+    }
+
+public Q_SLOTS:
+    void listDevices() noexcept
+    {
+        Q_EMIT devicesDiscovered(QtSaneScanner::getDevices());
+    }
+
+    void open(QString deviceName) noexcept
+    {
+        if (!QtSaneScanner::initialize())
+            return Q_EMIT deviceOpened(deviceName, nullptr);
+
+        auto scanner = new Scanner(deviceName);
+        if (!scanner->isOpened()) {
+            delete scanner;
+            return Q_EMIT deviceOpened(deviceName, nullptr);
+        }
+
+        // hand scanner over to the thread of the receiver
+        scanner->moveToThread(mOwnerThread);
+        Q_EMIT deviceOpened(deviceName, scanner);
+    }
+
+Q_SIGNALS:
+    void devicesDiscovered(QList<QtSaneScanner::DeviceInfo> devices);
+    void deviceOpened(QString deviceName, Scanner *scanner);
+
+private:
+    QThread *mOwnerThread;
+};
+
+int DeviceDiscovery::printDevices()
+{
+    // discovery helper lists the devices of the configured backends
+    auto output = QFile();
+    if (!output.open(stdout, QIODevice::WriteOnly))
+        return 1;
+
+    for (const auto &device : QtSaneScanner::getDevices()) {
+        const auto line = QString(device.name % QLatin1Char('\t') %
+            device.vendor % QLatin1Char('\t') % device.model %
+            QLatin1Char('\t') % device.type % QLatin1Char('\n'));
+        output.write(line.toUtf8());
+    }
+    output.close();
+    QtSaneScanner::shutdown();
+    return 0;
+}
+
+DeviceDiscovery::DeviceDiscovery(QObject *parent)
+    : QObject(parent)
+    , mWorker(new DiscoveryWorker())
+    , mOpenWorker(new OpenWorker(thread()))
+{
+    qRegisterMetaType<QList<QtSaneScanner::DeviceInfo>>();
+
+    mWorker->moveToThread(&mThread);
+    mOpenWorker->moveToThread(&mOpenThread);
+
+    connect(this, &DeviceDiscovery::doRefresh,
+        mWorker.data(), &DiscoveryWorker::refresh);
+    connect(this, &DeviceDiscovery::doOpen,
+        mOpenWorker.data(), &OpenWorker::open);
+    connect(mWorker.data(), &DiscoveryWorker::probingUnavailable,
+        mOpenWorker.data(), &OpenWorker::listDevices);
+
+    connect(mWorker.data(), &DiscoveryWorker::devicesDiscovered,
+        this, &DeviceDiscovery::devicesDiscovered);
+    connect(mOpenWorker.data(), &OpenWorker::devicesDiscovered,
+        this, &DeviceDiscovery::devicesDiscovered);
+    connect(mOpenWorker.data(), &OpenWorker::deviceOpened,
+        this, &DeviceDiscovery::deviceOpened);
+
+    mThread.start();
+    mOpenThread.start();
+}
+
+DeviceDiscovery::~DeviceDiscovery()
+{
+    QMetaObject::invokeMethod(mWorker.data(),
+        "stop", Qt::BlockingQueuedConnection);
+    mThread.wait();
+
+    // waits for a device which is still being opened
+    mOpenThread.quit();
+    mOpenThread.wait();
+}
+
+void DeviceDiscovery::refresh()
+{
+    Q_EMIT doRefresh(QPrivateSignal());
+}
+
+void DeviceDiscovery::open(const QString &deviceName)
+{
+    Q_EMIT doOpen(deviceName, QPrivateSignal());
+}
+
+#include "DeviceDiscovery.moc"
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <QObject>
+#include <QThread>
+#include "Scanner.h"
+
+class DiscoveryWorker;
+class OpenWorker;
+
+class DeviceDiscovery : public QObject
+{
+    Q_OBJECT
+public:
+    using DeviceInfo = QtSaneScanner::DeviceInfo;
+
+    static constexpr auto HelperArgument = "--list-devices";
+    static int printDevices();
+
+    explicit DeviceDiscovery(QObject *parent = nullptr);
+    ~DeviceDiscovery();
+
+    void refresh();
+    void open(const QString &deviceName);
+
+Q_SIGNALS:
+    void doRefresh(QPrivateSignal);
+    void doOpen(QString deviceName, QPrivateSignal);
+    void devicesDiscovered(QList<QtSaneScanner::DeviceInfo> devices);
+    void deviceOpened(QString deviceName, Scanner *scanner);
+
+private:
+    QThread mThread;
+    QThread mOpenThread;
+    QScopedPointer<DiscoveryWorker> mWorker;
+    QScopedPointer<OpenWorker> mOpenWorker;
+};
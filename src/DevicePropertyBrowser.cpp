@@ -56,8 +56,6 @@ void DevicePropertyBrowser::setScanner(QtSaneScanner *scanner)
     if (mScanner) {
         disconnect(mScanner, &QtSaneScanner::optionsChanged, this,
             &DevicePropertyBrowser::handleOptionsChanged);
-        disconnect(mScanner, &QtSaneScanner::optionChanged, this,
-            &DevicePropertyBrowser::handleOptionChanged);
 
         clear();
         mProperties.clear();
@@ -71,8 +69,6 @@ void DevicePropertyBrowser::setScanner(QtSaneScanner *scanner)
 
         connect(mScanner, &QtSaneScanner::optionsChanged, this,
             &DevicePropertyBrowser::handleOptionsChanged);
-        connect(mScanner, &QtSaneScanner::optionChanged, this,
-            &DevicePropertyBrowser::handleOptionChanged);
 
         refreshProperties();
     }
@@ -140,33 +136,57 @@ void DevicePropertyBrowser::refreshProperties()
     disconnect(mPropertyManager, &QtVariantPropertyManager::valueChanged,
         this, &DevicePropertyBrowser::handleValueChanged);
 
-    auto activeProperties = QList<QtProperty *>();
     for (auto property : qAsConst(mProperties))
-        if (auto option = mScanner->findOption(property->whatsThis())) {
-            if (option->isActive() && (option->isAdvanced() || mShowAdvanced)) {
+        if (auto option = mScanner->findOption(property->whatsThis()))
+            if (isPropertyShown(*option))
                 refreshProperty(*property, *option);
+    updateShownProperties();
+
+    connect(mPropertyManager, &QtVariantPropertyManager::valueChanged,
+        this, &DevicePropertyBrowser::handleValueChanged);
+}
+
+void DevicePropertyBrowser::updateShownProperties()
+{
+    auto activeProperties = QList<QtProperty *>();
+    for (auto property : qAsConst(mProperties))
+        if (auto option = mScanner->findOption(property->whatsThis()))
+            if (isPropertyShown(*option))
                 activeProperties.append(property);
-            }
-        }
 
     if (activeProperties != properties()) {
         clear();
         for (auto property : qAsConst(activeProperties))
             addProperty(property);
     }
-
-    connect(mPropertyManager, &QtVariantPropertyManager::valueChanged,
-        this, &DevicePropertyBrowser::handleValueChanged);
 }
 
-void DevicePropertyBrowser::handleOptionsChanged()
+bool DevicePropertyBrowser::isPropertyShown(
+    const QtSaneScanner::Option &option) const
 {
-    refreshProperties();
+    return (option.isActive() && (option.isAdvanced() || mShowAdvanced));
 }
 
-void DevicePropertyBrowser::handleOptionChanged(const QtSaneScanner::Option &option)
+void DevicePropertyBrowser::handleOptionsChanged(
+    const QtSaneScanner::OptionChanges &changes)
 {
-    refreshProperty(*mProperties[option.name()], option);
+    disconnect(mPropertyManager, &QtVariantPropertyManager::valueChanged,
+        this, &DevicePropertyBrowser::handleValueChanged);
+
+    // only properties of changed options are refreshed
+    for (auto index : changes.indices) {
+        const auto &option = mScanner->option(index);
+        if (auto property = mProperties.value(option.name()))
+            if (isPropertyShown(option))
+                refreshProperty(*property, option);
+    }
+
+    // options can only become active or inactive with their descriptors
+    if (changes.descriptorsChanged)
+        updateShownProperties();
+
+    connect(mPropertyManager, &QtVariantPropertyManager::valueChanged,
+        this, &DevicePropertyBrowser::handleValueChanged);
 }
 
 void DevicePropertyBrowser::handleValueChanged(QtProperty *property, const QVariant &value)
@@ -2,6 +2,7 @@
 
 #include "qtsanescanner/src/qtsanescanner.h"
 #include "qtpropertybrowser/src/qttreepropertybrowser.h"
+#include <QMap>
 
 class QtVariantPropertyManager;
 class QtVariantProperty;
@@ -19,12 +20,13 @@ public:
 private Q_SLOTS:
     void handleValueChanged(QtProperty *property,
         const QVariant &value);
-    void handleOptionsChanged();
-    void handleOptionChanged(const QtSaneScanner::Option &option);
+    void handleOptionsChanged(const QtSaneScanner::OptionChanges &changes);
 
 private:
     void createProperty(const QtSaneScanner::Option &option);
     void refreshProperties();
+    void updateShownProperties();
+    bool isPropertyShown(const QtSaneScanner::Option &option) const;
     void refreshProperty(QtProperty &property,
         const QtSaneScanner::Option &option);
 
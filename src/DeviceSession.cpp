@@ -0,0 +1,163 @@
+#include "DeviceSession.h"
+#include "Scanner.h"
+#include "WorkerThread.h"
+#include "PageWriter.h"
+#include "GraphicsImageItem.h"
+#include <QGraphicsScene>
+#include <QDir>
+
+DeviceSession::DeviceSession(const QString &deviceName,
+        QGraphicsScene *scene, QObject *parent)
+    : QObject(parent)
+    , mDeviceName(deviceName)
+    , mWorkerThread(new WorkerThread(this))
+    , mPreviewItem(new GraphicsImageItem())
+    , mImageItem(new GraphicsImageItem())
+{
+    scene->addItem(mPreviewItem);
+    scene->addItem(mImageItem);
+
+    connect(mWorkerThread, &WorkerThread::scanStarted,
+        this, &DeviceSession::handleScanStarted);
+    connect(mWorkerThread, &WorkerThread::scanLinesScanned,
+        this, &DeviceSession::handleScanLinesScanned);
+    connect(mWorkerThread, &WorkerThread::pageScanned,
+        this, &DeviceSession::handlePageScanned);
+    connect(mWorkerThread, &WorkerThread::scanStatisticsRecorded,
+        this, &DeviceSession::scanStatisticsRecorded);
+    connect(mWorkerThread, &WorkerThread::scanComplete,
+        this, &DeviceSession::handleScanComplete);
+    connect(mWorkerThread, &WorkerThread::scanStalled,
+        this, &DeviceSession::handleScanStalled);
+    connect(mWorkerThread, &WorkerThread::scanHung,
+        this, &DeviceSession::handleScanHung);
+}
+
+DeviceSession::~DeviceSession()
+{
+    // stops reading before the items are destroyed
+    delete mWorkerThread;
+    delete mPreviewItem;
+    delete mImageItem;
+}
+
+QThread *DeviceSession::deviceThread() const
+{
+    return mWorkerThread->deviceThread();
+}
+
+void DeviceSession::setVisible(bool visible)
+{
+    mPreviewItem->setVisible(visible);
+    mImageItem->setVisible(visible);
+}
+
+void DeviceSession::preview(Scanner *scanner)
+{
+    if (isScanning())
+        return;
+
+    mImageItem->clear();
+    mBatchScanning = false;
+    mBatchPageWriter = nullptr;
+    startScan(scanner, mPreviewItem);
+    mWorkerThread->scan(scanner, true);
+}
+
+void DeviceSession::scan(Scanner *scanner, PageWriter *batchPageWriter,
+    BatchTarget batchTarget)
+{
+    if (isScanning())
+        return;
+
+    mImageItem->clear();
+    mImageItem->setPos(scanner->getBounds().topLeft());
+    mBatchScanning = (batchPageWriter != nullptr);
+    mBatchPageWriter = batchPageWriter;
+    mBatchTarget = std::move(batchTarget);
+    startScan(scanner, mImageItem);
+    if (mBatchScanning)
+        mWorkerThread->scanBatch(scanner, batchPageWriter);
+    else
+        mWorkerThread->scan(scanner, false);
+}
+
+QString DeviceSession::takeBatchFileName()
+{
+    // pages are named by the target of the batch, not the current input
+    const auto dir = QDir(mBatchTarget.folder);
+    const auto filename = mBatchTarget.title +
+        mBatchTarget.indexSeparator + QString::number(mBatchTarget.index++);
+    return dir.filePath(filename + ".jpg");
+}
+
+void DeviceSession::cancelScan()
+{
+    mWorkerThread->cancelScan();
+}
+
+bool DeviceSession::stop()
+{
+    return mWorkerThread->stop();
+}
+
+void DeviceSession::startScan(Scanner *scanner, GraphicsImageItem *item)
+{
+    // settings are recorded, since scanner is not accessed after start
+    mScanningItem = item;
+    mStalled = false;
+    mScanSettings = QJsonObject{
+        { "device", mDeviceName },
+        { "source", scanner->getSource() },
+        { "resolution", scanner->getResolution().x() },
+    };
+}
+
+void DeviceSession::handleScanStarted(ScanImage image)
+{
+    mScanningItem->setImage(image);
+}
+
+void DeviceSession::handleScanLinesScanned(QByteArray scanLines,
+    int bytesPerLine, QtSaneScanner::Frame frame)
+{
+    mScanningItem->setNextScanLines(scanLines, bytesPerLine, frame);
+}
+
+void DeviceSession::handlePageScanned()
+{
+    mScanningItem->finishScan();
+    Q_EMIT pageScanned(mScanningItem->image());
+}
+
+void DeviceSession::handleScanComplete(bool succeeded)
+{
+    if (mScanningItem)
+        mScanningItem->finishScan();
+    mScanningItem = nullptr;
+    Q_EMIT scanComplete(succeeded);
+    mBatchScanning = false;
+}
+
+void DeviceSession::handleScanStalled(QString diagnostics)
+{
+    // recorded with the scan statistics
+    mStalled = true;
+    mScanSettings.insert("stall", diagnostics);
+}
+
+void DeviceSession::handleScanHung()
+{
+    // lines received so far are kept, late signals of the
+    // reading thread are ignored, until its read returns
+    mHung = true;
+    mWorkerThread->disconnect(this);
+    connect(mWorkerThread, &WorkerThread::scanComplete,
+        this, &DeviceSession::hungScanReturned);
+
+    // a page which was still handed over is not written
+    if (auto pageWriter = mBatchPageWriter)
+        connect(mWorkerThread, &WorkerThread::pageScanned,
+            pageWriter, &PageWriter::releasePage);
+    handleScanComplete(false);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QObject>
+#include <QJsonObject>
+#include "qtsanescanner/src/qtsanescanner.h"
+#include "ScanImage.h"
+
+class Scanner;
+class WorkerThread;
+class PageWriter;
+class QGraphicsScene;
+class GraphicsImageItem;
+
+// scan state of a device, with its own reading thread and items,
+// so that multiple devices can scan concurrently
+class DeviceSession : public QObject
+{
+    Q_OBJECT
+public:
+    // where the pages of a batch are written, recorded when it starts
+    struct BatchTarget
+    {
+        QString folder;
+        QString title;
+        QString indexSeparator;
+        int index{ };
+    };
+
+    DeviceSession(const QString &deviceName, QGraphicsScene *scene,
+        QObject *parent = nullptr);
+    ~DeviceSession();
+
+    const QString &deviceName() const { return mDeviceName; }
+    GraphicsImageItem *imageItem() const { return mImageItem; }
+    bool isScanning() const { return (mScanningItem != nullptr); }
+    bool isBatchScanning() const { return mBatchScanning; }
+    // last scan stalled and the device should be reopened
+    bool isStalled() const { return mStalled; }
+    // reading thread is blocked in the backend for good
+    bool isHung() const { return mHung; }
+    const QJsonObject &scanSettings() const { return mScanSettings; }
+    const BatchTarget &batchTarget() const { return mBatchTarget; }
+    QString takeBatchFileName();
+    QThread *deviceThread() const;
+    void setVisible(bool visible);
+    void preview(Scanner *scanner);
+    void scan(Scanner *scanner, PageWriter *batchPageWriter,
+        BatchTarget batchTarget);
+    void cancelScan();
+    // false when the reading thread is left running, the session and
+    // the objects its thread uses must not be destroyed then
+    bool stop();
+
+Q_SIGNALS:
+    void pageScanned(QImage image);
+    void scanStatisticsRecorded(QtSaneScanner::ScanStatistics statistics);
+    void scanComplete(bool succeeded);
+    // reading thread returned from the backend after the scan was hung
+    void hungScanReturned();
+
+private:
+    void startScan(Scanner *scanner, GraphicsImageItem *item);
+    void handleScanStarted(ScanImage image);
+    void handleScanLinesScanned(QByteArray scanLines, int bytesPerLine,
+        QtSaneScanner::Frame frame);
+    void handlePageScanned();
+    void handleScanComplete(bool succeeded);
+    void handleScanStalled(QString diagnostics);
+    void handleScanHung();
+
+    QString mDeviceName;
+    WorkerThread *mWorkerThread;
+    GraphicsImageItem *mPreviewItem;
+    GraphicsImageItem *mImageItem;
+    GraphicsImageItem *mScanningItem{ };
+    bool mBatchScanning{ };
+    PageWriter *mBatchPageWriter{ };
+    bool mStalled{ };
+    bool mHung{ };
+    QJsonObject mScanSettings;
+    BatchTarget mBatchTarget;
+};
@@ -1,50 +1,117 @@
 #include "GraphicsImageItem.h"
 #include <QPainter>
+#include <algorithm>
 #include <cstring>
 
+namespace
+{
+    // copies a color plane to every n-th sample of an interleaved line,
+    // written so that it can be vectorized by the compiler
+    template<typename T, int Stride>
+    void interleavePlane(T *__restrict dest, const T *__restrict source,
+        int width)
+    {
+        for (auto x = 0; x < width; ++x)
+            dest[x * Stride] = source[x];
+    }
+} // namespace
+
 GraphicsImageItem::GraphicsImageItem(QGraphicsItem *parent)
     : QGraphicsItem(parent)
 {
     setFlags(QGraphicsItem::ItemSendsGeometryChanges);
 }
 
-void GraphicsImageItem::setImage(const QImage &image)
+void GraphicsImageItem::setImage(const ScanImage &image)
 {
     prepareGeometryChange();
 
-    mImage = image;
+    mScanImage = image;
+    mImage = { };
     mNextScanLine = 0;
+    mScannedLines = 0;
 
-    const auto dpm = QPointF(mImage.dotsPerMeterX(), mImage.dotsPerMeterY());
+    const auto dpm = mScanImage.dotsPerMeter();
     auto transform = QTransform().scale(1000 / dpm.x(), 1000 / dpm.y());
     setTransform(transform);
 }
 
+void GraphicsImageItem::finishScan()
+{
+    if (mScanImage.isNull())
+        return;
+
+    prepareGeometryChange();
+
+    mImage = mScanImage.toImage(mScannedLines);
+    mScanImage = { };
+}
+
 void GraphicsImageItem::clear()
 {
+    mScanImage = { };
     mImage = { };
     update();
 }
 
 QRectF GraphicsImageItem::boundingRect() const
 {
+    if (!mScanImage.isNull())
+        return QRect(0, 0, mScanImage.width(), mScanImage.isHeightKnown() ?
+            mScanImage.height() : mScannedLines);
     return QRect(QPoint(), mImage.size());
 }
 
-void GraphicsImageItem::setNextScanLine(const QByteArray &scanline)
+void GraphicsImageItem::setNextScanLines(const QByteArray &scanLines,
+    int bytesPerLine, QtSaneScanner::Frame frame)
 {
-    const auto y = mNextScanLine++;
-    if (y >= mImage.height())
+    // next color plane of a multi-frame scan starts at the top
+    if (frame != mFrame) {
+        mFrame = frame;
+        mNextScanLine = 0;
+    }
+
+    const auto first = mNextScanLine;
+    for (auto offset = 0; offset + bytesPerLine <= scanLines.size();
+            offset += bytesPerLine)
+        writeScanLine(mNextScanLine++, scanLines.constData() + offset,
+            bytesPerLine, frame);
+
+    if (mNextScanLine > mScannedLines) {
+        if (!mScanImage.isHeightKnown())
+            prepareGeometryChange();
+        mScannedLines = mNextScanLine;
+    }
+    update(0, first, mScanImage.width(), mNextScanLine - first);
+}
+
+void GraphicsImageItem::writeScanLine(int y, const char *scanLine,
+    int bytesPerLine, QtSaneScanner::Frame frame)
+{
+    const auto dest = mScanImage.scanLine(y);
+    if (!dest)
         return;
+    const auto format = mScanImage.format();
+    const auto w = mScanImage.width();
 
-    if (scanline.size() == mImage.bytesPerLine()) {
-        std::memcpy(mImage.scanLine(y), scanline.data(), scanline.size());
+    using Frame = QtSaneScanner::Frame;
+    if (frame == Frame::Red || frame == Frame::Green || frame == Frame::Blue) {
+        const auto channel = static_cast<int>(frame) - static_cast<int>(Frame::Red);
+        if (format == QImage::Format_RGBX64 &&
+            bytesPerLine >= w * static_cast<int>(sizeof(uint16_t)))
+            interleavePlane<uint16_t, 4>(
+                reinterpret_cast<uint16_t*>(dest) + channel,
+                reinterpret_cast<const uint16_t*>(scanLine), w);
+        else if (format == QImage::Format_RGB888 && bytesPerLine >= w)
+            interleavePlane<uchar, 3>(dest + channel,
+                reinterpret_cast<const uchar*>(scanLine), w);
+        return;
     }
-    else if (mImage.format() == QImage::Format_RGBX64 &&
-             scanline.size() >= mImage.width() * 3 * sizeof(uint16_t)) {
-        auto destRGBX = reinterpret_cast<uint16_t*>(mImage.scanLine(y));
-        auto sourceRGB = reinterpret_cast<const uint16_t*>(scanline.data());
-        const auto w = mImage.width();
+
+    if (format == QImage::Format_RGBX64 &&
+        bytesPerLine >= w * 3 * static_cast<int>(sizeof(uint16_t))) {
+        auto destRGBX = reinterpret_cast<uint16_t*>(dest);
+        auto sourceRGB = reinterpret_cast<const uint16_t*>(scanLine);
         for (auto x = 0; x < w; ++x) {
             *destRGBX++ = *sourceRGB++;
             *destRGBX++ = *sourceRGB++;
@@ -52,20 +119,27 @@ void GraphicsImageItem::setNextScanLine(const QByteArray &scanline)
             *destRGBX++ = 0xFFFF;
         }
     }
+    else if (format != QImage::Format_RGBX64 &&
+             bytesPerLine <= mScanImage.bytesPerLine()) {
+        // image lines may be padded
+        std::memcpy(dest, scanLine, bytesPerLine);
+    }
     else {
-        std::memset(mImage.scanLine(y), 0x00, mImage.bytesPerLine());
+        std::memset(dest, 0x00, mScanImage.bytesPerLine());
     }
-    update(0, y, mImage.width(), 1);
 }
 
 void GraphicsImageItem::paint(QPainter *painter,
     const QStyleOptionGraphicsItem *option, QWidget *widget)
 {
-    if (mImage.isNull())
+    if (mScanImage.isNull() && mImage.isNull())
         return;
 
-    if (mNextScanLine)
-        painter->drawImage(0, 0, mImage, 0, 0, mImage.width(), mNextScanLine);
+    if (!mScanImage.isNull())
+        mScanImage.draw(painter, mScannedLines);
+    else if (mScannedLines)
+        painter->drawImage(0, 0, mImage, 0, 0, mImage.width(),
+            std::min(mScannedLines, mImage.height()));
 
     auto pen = QPen();
     pen.setWidth(1);
@@ -2,21 +2,31 @@
 
 #include <QGraphicsItem>
 #include <QImage>
+#include "qtsanescanner/src/qtsanescanner.h"
+#include "ScanImage.h"
 
 class GraphicsImageItem : public QGraphicsItem
 {
 public:
     explicit GraphicsImageItem(QGraphicsItem *parent = nullptr);
 
-    void setImage(const QImage &image);
+    void setImage(const ScanImage &image);
+    void finishScan();
     void clear();
     const QImage &image() const { return mImage; }
     QRectF boundingRect() const override;
-    void setNextScanLine(const QByteArray &scanline);
+    void setNextScanLines(const QByteArray &scanLines, int bytesPerLine,
+        QtSaneScanner::Frame frame);
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
         QWidget *widget) override;
 
 private:
+    void writeScanLine(int y, const char *scanLine, int bytesPerLine,
+        QtSaneScanner::Frame frame);
+
+    ScanImage mScanImage;
     QImage mImage;
+    QtSaneScanner::Frame mFrame{ };
     int mNextScanLine{ };
+    int mScannedLines{ };
 };
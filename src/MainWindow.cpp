@@ -1,18 +1,64 @@
 #include "MainWindow.h"
 #include "./ui_MainWindow.h"
-#include "WorkerThread.h"
+#include "DeviceDiscovery.h"
+#include "DeviceSession.h"
+#include "ScannerPool.h"
+#include "PageWriter.h"
 #include "CropRect.h"
 #include "GraphicsImageItem.h"
 #include <QSettings>
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QMouseEvent>
+#include <QSignalBlocker>
+#include <QStandardPaths>
+#include <QUrl>
+#include <QDateTime>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
 #include <QTimer>
 
+namespace
+{
+    // opening a device again after its hung read returned is retried,
+    // with the delay doubled each time
+    const auto maxReopenAttempts = 5;
+    const auto reopenDelayMsec = 1000;
+
+    QJsonObject toJson(const QtSaneScanner::ScanStatistics &stats)
+    {
+        auto readLatencies = QJsonArray();
+        for (auto count : stats.readLatencies)
+            readLatencies.append(count);
+
+        return QJsonObject{
+            { "parametersUsec", stats.parametersUsec },
+            { "firstByteUsec", stats.firstByteUsec },
+            { "lastByteUsec", stats.lastByteUsec },
+            { "frames", stats.frames },
+            { "reads", stats.reads },
+            { "emptyReads", stats.emptyReads },
+            { "bytesRead", stats.bytesRead },
+            { "bytesPerRead", stats.bytesPerRead() },
+            { "maxBytesPerRead", stats.maxBytesPerRead },
+            { "throughput", stats.throughput() },
+            { "readUsec", stats.readUsec },
+            { "gapUsec", stats.gapUsec },
+            { "maxGapUsec", stats.maxGapUsec },
+            { "readLatencies", readLatencies },
+        };
+    }
+} // namespace
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
-    , mWorkerThread(new WorkerThread(this))
+    , mDeviceDiscovery(new DeviceDiscovery(this))
+    , mScannerPool(new ScannerPool(this))
+    , mPageWriter(new PageWriter(this))
     , mSettings(new QSettings(this))
 {
     ui->setupUi(this);
@@ -24,10 +70,6 @@ MainWindow::MainWindow(QWidget *parent)
     setWindowIcon(icon);
 
     mScene = ui->pageView->scene();
-    mPreviewItem = new GraphicsImageItem();
-    mScene->addItem(mPreviewItem);
-    mImageItem = new GraphicsImageItem();
-    mScene->addItem(mImageItem);
     mCropRect = new CropRect();
 
     ui->widgetIndex->setEnabled(false);
@@ -46,6 +88,14 @@ MainWindow::MainWindow(QWidget *parent)
         this, &MainWindow::updateSaveButton);
     connect(ui->title, &QLineEdit::textChanged,
         this, &MainWindow::updateSaveButton);
+    connect(ui->checkBoxBatch, &QCheckBox::toggled,
+        this, &MainWindow::updateScanButtons);
+    connect(ui->spinBoxGamma, &QDoubleSpinBox::valueChanged,
+        this, &MainWindow::handleGammaChanged);
+    connect(ui->comboFolder, &QComboBox::currentTextChanged,
+        this, &MainWindow::updateScanButtons);
+    connect(ui->title, &QLineEdit::textChanged,
+        this, &MainWindow::updateScanButtons);
     connect(ui->pageView, &PageView::mousePressed,
         this, &MainWindow::handlePageViewMousePressed);
     connect(ui->pageView, &PageView::zoomChanged,
@@ -55,25 +105,64 @@ MainWindow::MainWindow(QWidget *parent)
 
     connect(ui->comboDevice, &QComboBox::currentIndexChanged,
         this, &MainWindow::handleDeviceIndexChanged);
-    connect(mWorkerThread, &WorkerThread::scanStarted,
-        this, &MainWindow::handleScanStarted);
-    connect(mWorkerThread, &WorkerThread::scanComplete,
-        this, &MainWindow::handleScanComplete);
-    connect(mWorkerThread, &WorkerThread::scanLineScanned,
-        this, &MainWindow::handleScanLineScanned);
+    connect(mDeviceDiscovery, &DeviceDiscovery::devicesDiscovered,
+        this, &MainWindow::handleDevicesDiscovered);
+    connect(mDeviceDiscovery, &DeviceDiscovery::deviceOpened,
+        this, &MainWindow::handleDeviceOpened);
+    connect(mPageWriter, &PageWriter::pageWritten,
+        this, &MainWindow::handlePageWritten);
+
+    // the worker of a session accesses the scanner until it completed
+    mScannerPool->setInUseCheck([this](const QString &deviceName) {
+        const auto session = mSessions.value(deviceName);
+        return (session && session->isScanning());
+    });
 
     readSettings();
     updateScanButtons();
     updateSaveButton();
-    QTimer::singleShot(500, this, &MainWindow::refreshDevices);
+
+    // open last device while devices are still being enumerated
+    if (!mDeviceName.isEmpty())
+        openScanner(mDeviceName);
+    refreshDevices();
 }
 
 MainWindow::~MainWindow()
 {
-    delete mWorkerThread;
-    delete ui;
+    delete mDeviceDiscovery;
+
+    // reading threads which hung in the backend are left behind, together
+    // with the scanners and the page writer they still use
+    auto threadsLeft = false;
+    for (auto session : qAsConst(mSessions)) {
+        if (session->stop()) {
+            delete session;
+            continue;
+        }
+        const auto deviceName = session->deviceName();
+        qWarning() << "leaving hung device behind" << deviceName;
+        threadsLeft = true;
+        if (mScanner && mScanner->deviceName() == deviceName)
+            mScanner.take();
+        while (mScannerPool->take(deviceName)) { }
+    }
+    for (auto it = mAbandonedSessions.begin(); it != mAbandonedSessions.end(); ++it) {
+        if (it.key()->stop()) {
+            qDeleteAll(it.value());
+            delete it.key();
+            continue;
+        }
+        qWarning() << "leaving hung device behind" << it.key()->deviceName();
+        threadsLeft = true;
+    }
+    if (!threadsLeft)
+        delete mPageWriter;
     closeScanner();
-    Scanner::shutdown();
+    delete mScannerPool;
+    delete ui;
+    if (!threadsLeft)
+        Scanner::shutdown();
 }
 
 void MainWindow::readSettings()
@@ -86,10 +175,28 @@ void MainWindow::readSettings()
     else if (s.value("maximized").toBool())
         showMaximized();
 
+    auto devices = QList<QtSaneScanner::DeviceInfo>();
+    const auto deviceCount = s.beginReadArray("devices");
+    for (auto i = 0; i < deviceCount; ++i) {
+        s.setArrayIndex(i);
+        devices += QtSaneScanner::DeviceInfo{
+            s.value("name").toString(),
+            s.value("vendor").toString(),
+            s.value("model").toString(),
+            s.value("type").toString(),
+        };
+    }
+    s.endArray();
+    mDeviceName = s.value("device").toString();
+    setDevices(devices);
+
     mSource = s.value("source").toString();
     mResolution = s.value("resolution").toDouble();
     ui->indexSeparator->setText(s.value("indexSeparator", " ").toString());
     ui->checkBoxIndexed->setChecked(s.value("indexed").toBool());
+    ui->checkBoxBatch->setChecked(s.value("batch").toBool());
+    ui->spinBoxGamma->setValue(s.value("gamma", 1.0).toDouble());
+    mScanStatisticsFolder = s.value("scanStatisticsFolder").toString();
     const auto folders = s.value("recentFolders", QStringList()).toStringList();
     for (const auto &path : folders)
         addFolder(path);
@@ -105,10 +212,25 @@ void MainWindow::writeSettings()
         s.setValue("maximized", isMaximized());
     s.setValue("state", saveState());
 
+    s.beginWriteArray("devices", mDevices.size());
+    for (auto i = 0; i < mDevices.size(); ++i) {
+        const auto &device = mDevices[i];
+        s.setArrayIndex(i);
+        s.setValue("name", device.name);
+        s.setValue("vendor", device.vendor);
+        s.setValue("model", device.model);
+        s.setValue("type", device.type);
+    }
+    s.endArray();
+    s.setValue("device", mDeviceName);
+
     s.setValue("source", mSource);
     s.setValue("resolution", mResolution);
     s.setValue("indexSeparator", ui->indexSeparator->text());
     s.setValue("indexed", ui->checkBoxIndexed->isChecked());
+    s.setValue("batch", ui->checkBoxBatch->isChecked());
+    s.setValue("gamma", ui->spinBoxGamma->value());
+    s.setValue("scanStatisticsFolder", mScanStatisticsFolder);
     auto folders = QStringList();
     for (auto i = ui->comboFolder->count() - 1; i >= 0; --i)
         folders << ui->comboFolder->itemData(i).toString();
@@ -140,55 +262,247 @@ void MainWindow::closeEvent(QCloseEvent *event)
 
 void MainWindow::refreshDevices()
 {
-    const auto devices = Scanner::initialize();
+    mDeviceDiscovery->refresh();
+}
+
+void MainWindow::handleDevicesDiscovered(QList<QtSaneScanner::DeviceInfo> devices)
+{
+    setDevices(devices);
+
+    // open first device when none was selected yet
+    if (mDeviceName.isEmpty() && !devices.isEmpty())
+        ui->comboDevice->setCurrentIndex(0);
+}
+
+void MainWindow::setDevices(const QList<QtSaneScanner::DeviceInfo> &devices)
+{
+    const auto blocker = QSignalBlocker(ui->comboDevice);
+    mDevices = devices;
     ui->comboDevice->clear();
     for (const auto &device : devices)
         ui->comboDevice->addItem(device.vendor + " " + device.model, device.name);
+    ui->comboDevice->setCurrentIndex(ui->comboDevice->findData(mDeviceName));
     updateScanButtons();
 }
 
 void MainWindow::handleDeviceIndexChanged(int index)
 {
     const auto deviceName = ui->comboDevice->itemData(index).toString();
-    if (!deviceName.isEmpty())
+    if (!deviceName.isEmpty() && deviceName != mDeviceName)
         openScanner(deviceName);
 }
 
+QString MainWindow::getSnapshotFileName(const QString &deviceName) const
+{
+    // values are stored per device, identical models do not share them
+    const auto dir = QDir(QStandardPaths::writableLocation(
+        QStandardPaths::CacheLocation));
+    return dir.filePath("devices/" +
+        QString::fromLatin1(QUrl::toPercentEncoding(deviceName)));
+}
+
+DeviceSession *MainWindow::getSession(const QString &deviceName)
+{
+    if (auto session = mSessions.value(deviceName))
+        return session;
+
+    auto session = new DeviceSession(deviceName, mScene);
+    connect(session, &DeviceSession::pageScanned,
+        this, [this, session](QImage image) {
+            handlePageScanned(session, std::move(image));
+        });
+    connect(session, &DeviceSession::scanStatisticsRecorded,
+        this, [this, session](QtSaneScanner::ScanStatistics statistics) {
+            writeScanStatistics(session->scanSettings(), statistics);
+        });
+    connect(session, &DeviceSession::scanComplete,
+        this, [this, session](bool succeeded) {
+            handleScanComplete(session, succeeded);
+        });
+    mSessions.insert(deviceName, session);
+    return session;
+}
+
+void MainWindow::setSession(DeviceSession *session)
+{
+    // items of other devices are hidden, while they continue scanning
+    mSession = session;
+    for (auto other : qAsConst(mSessions))
+        other->setVisible(other == mSession);
+    updateScanButtons();
+    updateSaveButton();
+}
+
 void MainWindow::openScanner(const QString &deviceName)
 {
     closeScanner();
+    mDeviceName = deviceName;
+    setSession(getSession(deviceName));
 
-    mScanner.reset(new Scanner(deviceName));
-    if (mScanner->isOpened()) {
-        connect(mScanner.data(), &Scanner::optionValuesChanged,
-            this, &MainWindow::refreshControls);
+    // reuse device which is still open
+    if (auto scanner = mScannerPool->take(deviceName)) {
+        setScanner(scanner);
+        restoreScannerSettings();
+        return;
+    }
 
-        refreshControls();
+    // show options of last session until device is opened in background
+    setScanner(Scanner::loadSnapshot(deviceName,
+        getSnapshotFileName(deviceName)));
+    mDeviceDiscovery->open(deviceName);
+}
 
-        if (mScanner->getSource() != mSource)
-            mScanner->setSource(mSource);
+void MainWindow::handleDeviceOpened(QString deviceName, Scanner *scanner)
+{
+    // device may still be busy after it was closed
+    if (deviceName == mReopeningDevice) {
+        if (!scanner && deviceName == mDeviceName &&
+            mReopenAttempts < maxReopenAttempts) {
+            QTimer::singleShot(reopenDelayMsec << mReopenAttempts++, this,
+                [this, deviceName]() {
+                    if (deviceName == mReopeningDevice)
+                        mDeviceDiscovery->open(deviceName);
+                });
+            return;
+        }
+        mReopeningDevice.clear();
+    }
 
-        const auto resolution = mScanner->getResolution();
-        if (resolution.x() != mResolution || resolution.y() != mResolution)
-            mScanner->setResolution({ mResolution, mResolution });
+    // keep for later when another device was selected in the meantime
+    if (deviceName != mDeviceName || (mScanner && mScanner->isOpened())) {
+        mScannerPool->release(scanner);
+        return;
+    }
+
+    closeScanner();
+    setScanner(scanner);
+    if (mScanner) {
+        restoreScannerSettings();
     }
     else {
         QMessageBox(QMessageBox::Warning, QCoreApplication::applicationName(),
             tr("Opening scanner failed"));
-        closeScanner();
+        mDeviceName.clear();
+    }
+}
+
+void MainWindow::setScanner(Scanner *scanner)
+{
+    mScanner.reset(scanner);
+    if (mScanner) {
+        // keep device calls of option changes off the GUI thread
+        if (mSession)
+            mScanner->setDeviceThread(mSession->deviceThread());
+
+        connect(mScanner.data(), &Scanner::settingsChanged,
+            this, &MainWindow::refreshControls);
+
+        refreshControls(Scanner::AllSettings);
+        if (ui->groupBoxProperties->isVisible())
+            ui->propertyBrowser->setScanner(mScanner.data());
     }
+    updateScanButtons();
+}
+
+void MainWindow::restoreScannerSettings()
+{
+    auto transaction = Scanner::Transaction(mScanner.data());
+    if (mScanner->getSource() != mSource)
+        mScanner->setSource(mSource);
+
+    const auto resolution = mScanner->getResolution();
+    if (resolution.x() != mResolution || resolution.y() != mResolution)
+        mScanner->setResolution({ mResolution, mResolution });
+
+    mScanner->setToneCurve(ToneCurve(ui->spinBoxGamma->value()));
 }
 
 void MainWindow::closeScanner()
 {
     if (mScanner) {
-        disconnect(mScanner.data(), &Scanner::optionValuesChanged,
+        disconnect(mScanner.data(), &Scanner::settingsChanged,
             this, &MainWindow::refreshControls);
+        ui->propertyBrowser->setScanner(nullptr);
+        mScanner->setDeviceThread(nullptr);
+
+        // keep device open for when it is selected again
+        if (mScanner->isOpened()) {
+            mScanner->saveSnapshot(getSnapshotFileName(mScanner->deviceName()));
+            mScannerPool->release(mScanner.take());
+        }
         mScanner.reset();
     }
+    updateScanButtons();
+}
+
+void MainWindow::reopenScanner(const QString &deviceName)
+{
+    // device is closed, it is opened again when it is selected
+    delete mScannerPool->take(deviceName);
+    if (deviceName != mDeviceName)
+        return;
+
+    closeScanner();
+    delete mScannerPool->take(deviceName);
+    openScanner(deviceName);
+}
+
+void MainWindow::abandonSession(DeviceSession *session)
+{
+    // the reading thread is blocked in the backend, so the session and
+    // its device cannot be closed, they are left behind until the read
+    // returns and the device is opened again
+    const auto deviceName = session->deviceName();
+    qWarning() << "abandoning hung device" << deviceName;
+    session->disconnect(this);
+    session->setVisible(false);
+    mSessions.remove(deviceName);
+    if (mSession == session)
+        mSession = nullptr;
+
+    auto scanners = QList<Scanner*>();
+    if (mScanner && mScanner->deviceName() == deviceName) {
+        disconnect(mScanner.data(), &Scanner::settingsChanged,
+            this, &MainWindow::refreshControls);
+        ui->propertyBrowser->setScanner(nullptr);
+        scanners.append(mScanner.take());
+    }
+    while (auto scanner = mScannerPool->take(deviceName))
+        scanners.append(scanner);
+    mAbandonedSessions.insert(session, scanners);
+
+    connect(session, &DeviceSession::hungScanReturned, this,
+        [this, session, scanners, deviceName]() {
+            // session waits for its thread to exit when it is deleted
+            session->disconnect(this);
+            mAbandonedSessions.remove(session);
+            qDeleteAll(scanners);
+            session->deleteLater();
+            reopenAbandonedDevice(deviceName);
+        });
+
+    // show options of last session until device is opened again
+    if (deviceName == mDeviceName) {
+        setSession(getSession(deviceName));
+        setScanner(Scanner::loadSnapshot(deviceName,
+            getSnapshotFileName(deviceName)));
+    }
+    updateScanButtons();
+    updateSaveButton();
 }
 
-void MainWindow::refreshControls()
+void MainWindow::reopenAbandonedDevice(const QString &deviceName)
+{
+    // it is opened again when it is selected later
+    if (deviceName != mDeviceName || (mScanner && mScanner->isOpened()))
+        return;
+
+    mReopeningDevice = deviceName;
+    mReopenAttempts = 0;
+    mDeviceDiscovery->open(deviceName);
+}
+
+void MainWindow::refreshControls(int settings)
 {
     disconnect(ui->comboSource, &QComboBox::currentIndexChanged,
         this, &MainWindow::handleSourceChanged);
@@ -197,22 +511,28 @@ void MainWindow::refreshControls()
     disconnect(mCropRect, &CropRect::transforming,
         this, &MainWindow::handleCropRectTransforming);
 
-    ui->comboSource->clear();
-    for (const auto &source : mScanner->getSources())
-        ui->comboSource->addItem(tr(qPrintable(source)), source);
-    ui->comboSource->setCurrentIndex(
-        ui->comboSource->findData(mScanner->getSource()));
+    if (settings & Scanner::SourceSetting) {
+        ui->comboSource->clear();
+        for (const auto &source : mScanner->getSources())
+            ui->comboSource->addItem(tr(qPrintable(source)), source);
+        ui->comboSource->setCurrentIndex(
+            ui->comboSource->findData(mScanner->getSource()));
+    }
 
-    const auto resolutions = mScanner->getUniformResolutions();
-    ui->comboResolution->clear();
-    for (auto resolution : resolutions)
-        ui->comboResolution->addItem(QString::number(resolution), resolution);
-    ui->comboResolution->setCurrentIndex(
-        ui->comboResolution->findData(mResolution));
+    if (settings & Scanner::ResolutionSetting) {
+        const auto resolutions = mScanner->getUniformResolutions();
+        ui->comboResolution->clear();
+        for (auto resolution : resolutions)
+            ui->comboResolution->addItem(QString::number(resolution), resolution);
+        ui->comboResolution->setCurrentIndex(
+            ui->comboResolution->findData(mResolution));
+    }
 
-    const auto maximumBounds = mScanner->getMaximumBounds();
-    ui->pageView->setBounds(maximumBounds);
-    mCropRect->setMaximumBounds(maximumBounds);
+    if (settings & Scanner::BoundsSetting) {
+        const auto maximumBounds = mScanner->getMaximumBounds();
+        ui->pageView->setBounds(maximumBounds);
+        mCropRect->setMaximumBounds(maximumBounds);
+    }
 
     connect(ui->comboSource, &QComboBox::currentIndexChanged,
         this, &MainWindow::handleSourceChanged);
@@ -225,11 +545,12 @@ void MainWindow::refreshControls()
 void MainWindow::handleSourceChanged(int index)
 {
     const auto source = ui->comboSource->itemData(index).toString();
-    if (!source.isEmpty()) {
+    if (!source.isEmpty() && mScanner) {
         mSource = source;
         mScanner->setSource(source);
 
-        mImageItem->clear();
+        if (mSession)
+            mSession->imageItem()->clear();
         mCropRect->setBounds({});
     }
 }
@@ -237,12 +558,19 @@ void MainWindow::handleSourceChanged(int index)
 void MainWindow::handleResolutionChanged(int index)
 {
     const auto resolution = ui->comboResolution->itemData(index).toDouble();
-    if (resolution) {
+    if (resolution && mScanner) {
         mResolution = resolution;
         mScanner->setResolution({ resolution, resolution });
     }
 }
 
+void MainWindow::handleGammaChanged(double gamma)
+{
+    // applied when the next scan starts
+    if (mScanner)
+        mScanner->setToneCurve(ToneCurve(gamma));
+}
+
 void MainWindow::handlePageViewMousePressed(const QPointF &position)
 {
     mScene->addItem(mCropRect);
@@ -252,46 +580,90 @@ void MainWindow::handlePageViewMousePressed(const QPointF &position)
 
 void MainWindow::handleCropRectTransforming(const QRectF &bounds)
 {
-    mScanner->setBounds(bounds);
+    if (mScanner)
+        mScanner->setBounds(bounds);
     updateScanButtons();
 }
 
 void MainWindow::preview()
 {
-    if (mScanningItem)
+    if (!mSession || !mScanner || mSession->isScanning())
         return;
-    mImageItem->clear();
-    mScanningItem = mPreviewItem;
-    mWorkerThread->scan(mScanner.data(), true);
+    mSession->preview(mScanner.data());
     updateScanButtons();
 }
 
 void MainWindow::scan()
 {
-    if (mScanningItem)
+    if (!mSession || !mScanner || mSession->isScanning())
         return;
-    mImageItem->clear();
-    mImageItem->setPos(mScanner->getBounds().topLeft());
-    mScanningItem = mImageItem;
-    mWorkerThread->scan(mScanner.data(), false);
+    mSession->scan(mScanner.data(),
+        ui->checkBoxBatch->isChecked() ? mPageWriter : nullptr,
+        { ui->comboFolder->currentData().toString(), ui->title->text(),
+          ui->indexSeparator->text(), ui->spinBoxIndex->value() });
     updateScanButtons();
 }
 
-void MainWindow::handleScanStarted(QImage image)
+void MainWindow::handlePageScanned(DeviceSession *session, QImage image)
 {
-    mScanningItem->setImage(image);
+    // pages are written in the background while the next page is scanned,
+    // pages of all devices are written by the same thread pool
+    mPageWriter->write(std::move(image), session->takeBatchFileName());
+
+    // index is only advanced while it is still the batch's target
+    const auto &target = session->batchTarget();
+    if (target.folder == ui->comboFolder->currentData().toString() &&
+        target.title == ui->title->text())
+        ui->spinBoxIndex->setValue(std::max(target.index,
+            ui->spinBoxIndex->value()));
 }
 
-void MainWindow::handleScanLineScanned(QByteArray scanLine)
+void MainWindow::handlePageWritten(QString fileName, bool succeeded)
 {
-    mScanningItem->setNextScanLine(scanLine);
+    if (!succeeded)
+        QMessageBox(QMessageBox::Warning, QCoreApplication::applicationName(),
+            tr("Writing image file \"%1\" failed").arg(
+                QFileInfo(fileName).fileName())).exec();
+}
+
+void MainWindow::writeScanStatistics(const QJsonObject &scanSettings,
+    const QtSaneScanner::ScanStatistics &statistics)
+{
+    // optionally dump statistics of each scan, to compare devices and settings
+    if (mScanStatisticsFolder.isEmpty())
+        return;
+
+    const auto dir = QDir(mScanStatisticsFolder);
+    const auto now = QDateTime::currentDateTime();
+    auto object = toJson(statistics);
+    object.insert("time", now.toString(Qt::ISODate));
+    for (auto it = scanSettings.begin(); it != scanSettings.end(); ++it)
+        object.insert(it.key(), it.value());
+
+    auto file = QSaveFile(dir.filePath(
+        now.toString("'scan-'yyyyMMdd-hhmmss-zzz'.json'")));
+    if (!dir.mkpath(".") || !file.open(QIODevice::WriteOnly) ||
+        file.write(QJsonDocument(object).toJson()) < 0 || !file.commit())
+        qWarning() << "writing scan statistics failed";
 }
 
-void MainWindow::handleScanComplete(bool succeeded)
+void MainWindow::handleScanComplete(DeviceSession *session, bool succeeded)
 {
-    mScanningItem = nullptr;
+    // recover from stalled scans without an operator
+    if (session->isHung())
+        return abandonSession(session);
+    if (session->isStalled())
+        reopenScanner(session->deviceName());
+
+    if (session != mSession)
+        return;
+
     updateScanButtons();
     updateSaveButton();
+
+    // pages of batch were already saved
+    if (session->isBatchScanning())
+        ui->buttonSave->setEnabled(false);
 }
 
 void MainWindow::browse()
@@ -319,38 +691,49 @@ void MainWindow::addFolder(const QString &path)
 
 void MainWindow::updateScanButtons()
 {
-    const auto canScan = (mScanner && !mScanningItem);
+    const auto canScan = (mScanner && mScanner->isOpened() &&
+        mSession && !mSession->isScanning());
+    const auto canSave = (!ui->checkBoxBatch->isChecked() ||
+        (!ui->comboFolder->currentText().isEmpty() &&
+         !ui->title->text().isEmpty()));
     ui->buttonPreview->setEnabled(canScan);
-    ui->buttonScan->setEnabled(canScan && !mCropRect->bounds().isEmpty());
+    ui->buttonScan->setEnabled(canScan && canSave &&
+        !mCropRect->bounds().isEmpty());
 }
 
 void MainWindow::updateSaveButton()
 {
     ui->buttonSave->setEnabled(
-        !mImageItem->image().isNull() &&
+        mSession && !mSession->imageItem()->image().isNull() &&
         !ui->comboFolder->currentText().isEmpty() &&
         !ui->title->text().isEmpty());
 }
 
-void MainWindow::save()
+QString MainWindow::getFileName(bool indexed) const
 {
     const auto dir = QDir(ui->comboFolder->currentData().toString());
-    const auto index = ui->spinBoxIndex->value();
-
     auto filename = ui->title->text();
-    if (ui->checkBoxIndexed->isChecked()) {
+    if (indexed) {
         filename += ui->indexSeparator->text();
-        filename += QString::number(index);
+        filename += QString::number(ui->spinBoxIndex->value());
     }
     filename += ".jpg";
+    return dir.filePath(filename);
+}
+
+void MainWindow::save()
+{
+    const auto index = ui->spinBoxIndex->value();
+    const auto path = getFileName(ui->checkBoxIndexed->isChecked());
+    const auto filename = QFileInfo(path).fileName();
 
-    if (QFileInfo::exists(dir.filePath(filename)))
+    if (QFileInfo::exists(path))
         if (QMessageBox(QMessageBox::Warning, QCoreApplication::applicationName(),
             tr("A file named \"%1\" already exists.\nDo you want to replace it?").arg(filename),
             QMessageBox::Cancel | QMessageBox::Yes).exec() != QMessageBox::Yes)
             return;
 
-    if (!mImageItem->image().save(dir.filePath(filename), nullptr, 90)) {
+    if (!mSession->imageItem()->image().save(path, nullptr, 90)) {
         QMessageBox(QMessageBox::Warning, QCoreApplication::applicationName(),
             tr("Writing image file failed")).exec();
         return;
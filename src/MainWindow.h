@@ -1,6 +1,9 @@
 #pragma once
 
 #include <QMainWindow>
+#include <QImage>
+#include <QJsonObject>
+#include "qtsanescanner/src/qtsanescanner.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -8,9 +11,11 @@ QT_END_NAMESPACE
 
 class Scanner;
 class QSettings;
-class WorkerThread;
+class DeviceDiscovery;
+class DeviceSession;
+class ScannerPool;
+class PageWriter;
 class QGraphicsScene;
-class GraphicsImageItem;
 class CropRect;
 
 class MainWindow : public QMainWindow
@@ -30,15 +35,16 @@ public Q_SLOTS:
     void togglePropertyBrowser();
 
 private Q_SLOTS:
-    void refreshControls();
+    void refreshControls(int settings);
     void handleDeviceIndexChanged(int index);
+    void handleDevicesDiscovered(QList<QtSaneScanner::DeviceInfo> devices);
+    void handleDeviceOpened(QString deviceName, Scanner *scanner);
     void updateScanButtons();
     void updateSaveButton();
-    void handleScanStarted(QImage image);
-    void handleScanLineScanned(QByteArray scanLine);
-    void handleScanComplete(bool succeeded);
+    void handlePageWritten(QString fileName, bool succeeded);
     void handleSourceChanged(int index);
     void handleResolutionChanged(int index);
+    void handleGammaChanged(double gamma);
     void handleCropRectTransforming(const QRectF &);
     void handlePageViewMousePressed(const QPointF &position);
 
@@ -47,22 +53,44 @@ protected:
     void closeEvent(QCloseEvent *event);
 
 private:
+    void setDevices(const QList<QtSaneScanner::DeviceInfo> &devices);
+    QString getSnapshotFileName(const QString &deviceName) const;
+    DeviceSession *getSession(const QString &deviceName);
+    void setSession(DeviceSession *session);
+    void handlePageScanned(DeviceSession *session, QImage image);
+    void handleScanComplete(DeviceSession *session, bool succeeded);
+    void writeScanStatistics(const QJsonObject &scanSettings,
+        const QtSaneScanner::ScanStatistics &statistics);
+    void setScanner(Scanner *scanner);
+    void restoreScannerSettings();
     void openScanner(const QString &deviceName);
     void closeScanner();
+    void reopenScanner(const QString &deviceName);
+    void abandonSession(DeviceSession *session);
+    void reopenAbandonedDevice(const QString &deviceName);
     void addFolder(const QString &path);
+    QString getFileName(bool indexed) const;
     void readSettings();
     void writeSettings();
 
     Ui::MainWindow *ui;
     QSettings *mSettings;
-    WorkerThread *mWorkerThread;
+    DeviceDiscovery *mDeviceDiscovery;
+    ScannerPool *mScannerPool;
+    PageWriter *mPageWriter;
+    QList<QtSaneScanner::DeviceInfo> mDevices;
+    QString mDeviceName;
     QScopedPointer<Scanner> mScanner;
+    QHash<QString, DeviceSession*> mSessions;
+    // hung sessions with the scanners their thread still uses
+    QHash<DeviceSession*, QList<Scanner*>> mAbandonedSessions;
+    DeviceSession *mSession{ };
 
     QGraphicsScene *mScene{ };
     CropRect *mCropRect{ };
-    GraphicsImageItem *mPreviewItem{ };
-    GraphicsImageItem *mImageItem{ };
-    GraphicsImageItem *mScanningItem{ };
     double mResolution{ };
     QString mSource;
+    QString mScanStatisticsFolder;
+    QString mReopeningDevice;
+    int mReopenAttempts{ };
 };
@@ -0,0 +1,36 @@
+#include "PageWriter.h"
+#include <QThread>
+#include <algorithm>
+
+PageWriter::PageWriter(QObject *parent)
+    : QObject(parent)
+{
+    mThreadPool.setMaxThreadCount(
+        std::min(QThread::idealThreadCount(), MaximumPagesInFlight));
+}
+
+PageWriter::~PageWriter()
+{
+    mThreadPool.waitForDone();
+}
+
+bool PageWriter::tryAcquirePage()
+{
+    return mPages.tryAcquire();
+}
+
+void PageWriter::releasePage()
+{
+    mPages.release();
+    Q_EMIT pageReleased();
+}
+
+void PageWriter::write(QImage image, QString fileName)
+{
+    mThreadPool.start([this, image = std::move(image),
+                       fileName = std::move(fileName)]() {
+        const auto succeeded = image.save(fileName, nullptr, 90);
+        releasePage();
+        Q_EMIT pageWritten(fileName, succeeded);
+    });
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QObject>
+#include <QImage>
+#include <QThreadPool>
+#include <QSemaphore>
+
+// encodes and writes the pages of a batch scan in the background,
+// the number of pages in flight is bounded to limit memory usage
+class PageWriter : public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr int MaximumPagesInFlight = 4;
+
+    explicit PageWriter(QObject *parent = nullptr);
+    ~PageWriter();
+
+    // called by the scanning thread before a page is started,
+    // when it fails it is tried again when a page was released
+    bool tryAcquirePage();
+    void releasePage();
+    // takes over a page acquired before
+    void write(QImage image, QString fileName);
+
+Q_SIGNALS:
+    void pageReleased();
+    void pageWritten(QString fileName, bool succeeded);
+
+private:
+    QThreadPool mThreadPool;
+    QSemaphore mPages{ MaximumPagesInFlight };
+};
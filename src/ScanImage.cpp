@@ -0,0 +1,79 @@
+#include "ScanImage.h"
+#include <QPainter>
+#include <algorithm>
+#include <cstring>
+
+ScanImage::ScanImage(int width, int height, QImage::Format format,
+        const QPointF &dotsPerMeter)
+    : mWidth(width)
+    , mHeight(height)
+    , mStripHeight(height >= 0 ? height : StripHeight)
+    , mFormat(format)
+    , mDotsPerMeter(dotsPerMeter)
+{
+    // known height is stored in a single strip
+    auto strip = QImage(mWidth, mStripHeight, mFormat);
+    strip.fill(Qt::black);
+    mStrips.append(strip);
+}
+
+int ScanImage::height() const
+{
+    return (isHeightKnown() ? mHeight :
+        static_cast<int>(mStrips.size()) * mStripHeight);
+}
+
+int ScanImage::bytesPerLine() const
+{
+    return (isNull() ? 0 : static_cast<int>(mStrips.front().bytesPerLine()));
+}
+
+uchar *ScanImage::scanLine(int y)
+{
+    if (y < 0 || (isHeightKnown() && y >= mHeight) || !mStripHeight)
+        return nullptr;
+
+    // append strips without moving the lines already scanned
+    const auto index = y / mStripHeight;
+    while (index >= mStrips.size()) {
+        auto strip = QImage(mWidth, mStripHeight, mFormat);
+        strip.fill(Qt::black);
+        mStrips.append(strip);
+    }
+    return mStrips[index].scanLine(y % mStripHeight);
+}
+
+void ScanImage::draw(QPainter *painter, int lineCount) const
+{
+    for (auto i = 0; i < mStrips.size(); ++i) {
+        const auto top = i * mStripHeight;
+        const auto lines = std::min(lineCount - top, mStripHeight);
+        if (lines <= 0)
+            break;
+        painter->drawImage(0, top, mStrips[i], 0, 0, mWidth, lines);
+    }
+}
+
+QImage ScanImage::toImage(int lineCount) const
+{
+    if (isNull())
+        return { };
+
+    auto image = QImage();
+    if (isHeightKnown()) {
+        image = mStrips.front();
+    }
+    else {
+        // copy strips to a contiguous image once the scan is complete
+        lineCount = std::clamp(lineCount, 0, height());
+        image = QImage(mWidth, lineCount, mFormat);
+        const auto bytesPerLine = static_cast<size_t>(this->bytesPerLine());
+        for (auto y = 0; y < lineCount; ++y)
+            std::memcpy(image.scanLine(y),
+                mStrips[y / mStripHeight].constScanLine(y % mStripHeight),
+                bytesPerLine);
+    }
+    image.setDotsPerMeterX(static_cast<int>(mDotsPerMeter.x()));
+    image.setDotsPerMeterY(static_cast<int>(mDotsPerMeter.y()));
+    return image;
+}
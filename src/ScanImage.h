@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QImage>
+#include <QList>
+#include <QPointF>
+#include <QMetaType>
+
+class QPainter;
+
+// image which is filled line by line and grows in strips
+// when the number of lines is not known in advance
+class ScanImage
+{
+public:
+    static constexpr int StripHeight = 256;
+
+    ScanImage() = default;
+    ScanImage(int width, int height, QImage::Format format,
+        const QPointF &dotsPerMeter);
+
+    bool isNull() const { return mStrips.isEmpty(); }
+    bool isHeightKnown() const { return (mHeight >= 0); }
+    int width() const { return mWidth; }
+    int height() const;
+    int bytesPerLine() const;
+    QImage::Format format() const { return mFormat; }
+    const QPointF &dotsPerMeter() const { return mDotsPerMeter; }
+    uchar *scanLine(int y);
+    void draw(QPainter *painter, int lineCount) const;
+    QImage toImage(int lineCount) const;
+
+private:
+    QList<QImage> mStrips;
+    int mWidth{ };
+    int mHeight{ -1 };
+    int mStripHeight{ };
+    QImage::Format mFormat{ };
+    QPointF mDotsPerMeter;
+};
+
+Q_DECLARE_METATYPE(ScanImage)
@@ -0,0 +1,82 @@
+#include "ScanWatchdog.h"
+#include <algorithm>
+
+namespace
+{
+    // device may warm up and calibrate before the first line
+    const auto warmUpMsec = qint64{ 120000 };
+    const auto minStallMsec = qint64{ 30000 };
+    // a stall lasts a multiple of the time a line took so far
+    const auto stallLineFactor = qint64{ 50 };
+} // namespace
+
+ScanWatchdog::ScanWatchdog(QObject *parent)
+    : QObject(parent)
+{
+    mClock.start();
+    mTimer.setInterval(1000);
+    connect(&mTimer, &QTimer::timeout, this, &ScanWatchdog::check);
+}
+
+void ScanWatchdog::start(const QtSaneScanner::Parameters &parameters)
+{
+    auto lock = QMutexLocker(&mMutex);
+    mParameters = parameters;
+    mActive = true;
+    mStalled = false;
+    mStartMsec = mClock.elapsed();
+    mFirstByteMsec = -1;
+    mLastProgressMsec = mStartMsec;
+    mBytesRead = 0;
+    lock.unlock();
+
+    QMetaObject::invokeMethod(this, [this]() { mTimer.start(); });
+}
+
+void ScanWatchdog::progress(qint64 bytes)
+{
+    auto lock = QMutexLocker(&mMutex);
+    mLastProgressMsec = mClock.elapsed();
+    if (mFirstByteMsec < 0)
+        mFirstByteMsec = mLastProgressMsec;
+    mBytesRead += bytes;
+}
+
+void ScanWatchdog::stop()
+{
+    auto lock = QMutexLocker(&mMutex);
+    mActive = false;
+    lock.unlock();
+
+    QMetaObject::invokeMethod(this, [this]() { mTimer.stop(); });
+}
+
+void ScanWatchdog::check()
+{
+    auto lock = QMutexLocker(&mMutex);
+    if (!mActive || mStalled)
+        return;
+
+    const auto lines = mBytesRead / std::max(mParameters.bytesPerLine, 1);
+    auto limit = warmUpMsec;
+    if (lines > 0) {
+        const auto msecPerLine = (mLastProgressMsec - mFirstByteMsec) / lines;
+        limit = std::max(minStallMsec, stallLineFactor * msecPerLine);
+    }
+
+    const auto idle = mClock.elapsed() - mLastProgressMsec;
+    if (idle < limit)
+        return;
+
+    mStalled = true;
+    const auto diagnostics = QStringLiteral(
+        "no data for %1 s (limit %2 s) after %3 s, %4 of %5 lines, %6 bytes read")
+        .arg(idle / 1000).arg(limit / 1000)
+        .arg((mLastProgressMsec - mStartMsec) / 1000).arg(lines)
+        .arg(mParameters.lines >= 0 ?
+            QString::number(mParameters.lines) : QStringLiteral("unknown"))
+        .arg(mBytesRead);
+    lock.unlock();
+
+    Q_EMIT stalled(diagnostics);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "qtsanescanner/src/qtsanescanner.h"
+#include <QElapsedTimer>
+#include <QTimer>
+
+// detects scans which stopped delivering data, the limit is derived
+// from the line rate which was observed so far
+class ScanWatchdog : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ScanWatchdog(QObject *parent = nullptr);
+
+    // can be called from the reading thread
+    void start(const QtSaneScanner::Parameters &parameters);
+    void progress(qint64 bytes);
+    void stop();
+
+Q_SIGNALS:
+    void stalled(QString diagnostics);
+
+private:
+    void check();
+
+    QTimer mTimer;
+    QElapsedTimer mClock;
+    QMutex mMutex;
+    QtSaneScanner::Parameters mParameters{ };
+    bool mActive{ };
+    bool mStalled{ };
+    qint64 mStartMsec{ };
+    qint64 mFirstByteMsec{ -1 };
+    qint64 mLastProgressMsec{ };
+    qint64 mBytesRead{ };
+};
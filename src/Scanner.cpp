@@ -1,19 +1,56 @@
 #include "Scanner.h"
 #include <QSet>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDebug>
+#include <algorithm>
 
 namespace
 {
-    namespace WellKnownOption
+    // in order of Scanner::WellKnownOption
+    const QString wellKnownOptionNames[] = {
+        QStringLiteral("source"),
+        QStringLiteral("preview"),
+        QStringLiteral("resolution"),
+        QStringLiteral("x-resolution"),
+        QStringLiteral("y-resolution"),
+        QStringLiteral("tl-x"),
+        QStringLiteral("tl-y"),
+        QStringLiteral("br-x"),
+        QStringLiteral("br-y"),
+        QStringLiteral("custom-gamma"),
+        QStringLiteral("gamma-table"),
+        QStringLiteral("red-gamma-table"),
+        QStringLiteral("green-gamma-table"),
+        QStringLiteral("blue-gamma-table"),
+    };
+
+    QImage::Format getImageFormat(const QtSaneScanner::Parameters &parameters)
     {
-        const auto source = QStringLiteral("source");
-        const auto preview = QStringLiteral("preview");
-        const auto resolution = QStringLiteral("resolution");
-        const auto x_resolution = QStringLiteral("x-resolution");
-        const auto y_resolution = QStringLiteral("y-resolution");
-        const auto top_left_x = QStringLiteral("tl-x");
-        const auto top_left_y = QStringLiteral("tl-y");
-        const auto bottom_right_x = QStringLiteral("br-x");
-        const auto bottom_right_y = QStringLiteral("br-y");
+        using Frame = QtSaneScanner::Frame;
+        switch (parameters.frame) {
+            case Frame::Gray:
+                switch (parameters.depth) {
+                    case 1: return QImage::Format_Mono;
+                    case 8: return QImage::Format_Grayscale8;
+                    case 16: return QImage::Format_Grayscale16;
+                }
+                break;
+
+            case Frame::RGB:
+            case Frame::Red:
+            case Frame::Green:
+            case Frame::Blue:
+                switch (parameters.depth) {
+                    case 8: return QImage::Format_RGB888;
+                    case 16: return QImage::Format_RGBX64;
+                }
+                break;
+        }
+        return QImage::Format_Invalid;
     }
 
     QPair<double, double> getMinMax(const QtSaneScanner::Option &option)
@@ -47,108 +84,229 @@ namespace
 Scanner::Scanner(const QString &deviceName)
     : QtSaneScanner(deviceName)
 {
+    initializeOptions();
+}
+
+Scanner::Scanner(const QString &deviceName, QDataStream &snapshot)
+    : QtSaneScanner(deviceName, snapshot)
+{
+    initializeOptions();
+}
+
+Scanner *Scanner::loadSnapshot(const QString &deviceName,
+    const QString &fileName)
+{
+    auto file = QFile(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return nullptr;
+
+    auto stream = QDataStream(&file);
+    auto scanner = new Scanner(deviceName, stream);
+    if (scanner->options().isEmpty()) {
+        delete scanner;
+        return nullptr;
+    }
+    return scanner;
+}
+
+bool Scanner::saveSnapshot(const QString &fileName) const
+{
+    QDir().mkpath(QFileInfo(fileName).path());
+    auto file = QSaveFile(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    auto stream = QDataStream(&file);
+    writeSnapshot(stream);
+    return file.commit();
+}
+
+void Scanner::initializeOptions()
+{
+    static_assert(std::size(wellKnownOptionNames) ==
+        static_cast<size_t>(WellKnownOption::Count));
+    resolveWellKnownOptions();
+
+    connect(this, &QtSaneScanner::optionsChanged, this,
+        [this](const OptionChanges &changes) {
+            if (changes.descriptorsChanged)
+                resolveWellKnownOptions();
+        });
     connect(this, &QtSaneScanner::optionsChanged,
-        this, &Scanner::optionValuesChanged);
-    connect(this, &QtSaneScanner::optionChanged,
-        this, &Scanner::optionValuesChanged);
+        this, &Scanner::handleOptionsChanged);
+}
+
+void Scanner::resolveWellKnownOptions()
+{
+    for (auto i = 0; i < static_cast<int>(WellKnownOption::Count); ++i)
+        mWellKnownOptions[i] = findOptionIndex(wellKnownOptionNames[i]);
+}
+
+void Scanner::handleOptionsChanged(const OptionChanges &changes)
+{
+    auto settings = 0;
+    if (isAffected(changes, WellKnownOption::Source))
+        settings |= SourceSetting;
+
+    // available resolutions only depend on the descriptors
+    const auto resolutionAffected =
+        isAffected(changes, WellKnownOption::Resolution) ||
+        isAffected(changes, WellKnownOption::XResolution) ||
+        isAffected(changes, WellKnownOption::YResolution);
+    if (resolutionAffected && changes.descriptorsChanged)
+        settings |= ResolutionSetting;
+
+    // maximum bounds are given by the constraints of the bottom right
+    // corner, which are converted using the resolution
+    if (resolutionAffected ||
+        (changes.descriptorsChanged &&
+         (isAffected(changes, WellKnownOption::BottomRightX) ||
+          isAffected(changes, WellKnownOption::BottomRightY))))
+        settings |= BoundsSetting;
+
+    if (settings)
+        Q_EMIT settingsChanged(settings);
+}
+
+bool Scanner::isAffected(const OptionChanges &changes,
+    WellKnownOption option) const
+{
+    const auto index = mWellKnownOptions[static_cast<int>(option)];
+    return (index >= 0 && changes.contains(index));
 }
 
-QImage Scanner::startScan(bool preview)
+ScanImage Scanner::startScan(bool preview)
 {
     disconnect(this, &QtSaneScanner::optionsChanged,
-        this, &Scanner::optionValuesChanged);
-    disconnect(this, &QtSaneScanner::optionChanged,
-        this, &Scanner::optionValuesChanged);
+        this, &Scanner::handleOptionsChanged);
+
+    // device applies tone curve when it supports gamma tables
+    const auto curve = toneCurve();
+    mHostToneCurve = (applyToneCurve(curve) ? ToneCurve() : curve);
 
     const auto savedResolution = getResolution();
     const auto savedBounds = getBounds();
     if (preview) {
-        setOptionValue(WellKnownOption::preview, preview);
-        const auto resolutions = getUniformResolutions();
-        if (!resolutions.isEmpty())
-            setResolution(resolutions.first());
+        {
+            auto transaction = Transaction(this);
+            if (auto option = getOption(WellKnownOption::Preview))
+                option->setBoolValue(true);
+            const auto resolutions = getUniformResolutions();
+            if (!resolutions.isEmpty())
+                setResolution(resolutions.first());
+        }
+        // maximum bounds depend on the applied resolution
         setBounds(getMaximumBounds());
     }
 
-    const auto dpi = getResolution();
-    const auto dpiToDpm = 39.37;
-    auto image = QtSaneScanner::startScan();
-    image.setDotsPerMeterX(static_cast<int>(dpi.x() * dpiToDpm));
-    image.setDotsPerMeterY(static_cast<int>(dpi.y() * dpiToDpm));
+    // option values can not be fetched while scanning
+    const auto resolution = getResolution();
+    auto image = ScanImage();
+    if (QtSaneScanner::startScan())
+        image = createScanImage(resolution);
 
     if (preview) {
-        setOptionValue(WellKnownOption::preview, false);
+        auto transaction = Transaction(this);
+        if (auto option = getOption(WellKnownOption::Preview))
+            option->setBoolValue(false);
         setResolution(savedResolution);
         setBounds(savedBounds);
     }
     return image;
 }
 
+ScanImage Scanner::startNextPage()
+{
+    if (!QtSaneScanner::startNextPage())
+        return { };
+    return createScanImage(getResolution());
+}
+
+ScanImage Scanner::createScanImage(const QPointF &resolution) const
+{
+    // number of lines is negative when it is not known in advance
+    const auto &params = parameters();
+    const auto format = getImageFormat(params);
+    if (format == QImage::Format_Invalid) {
+        qWarning() << "unsupported scan format";
+        return { };
+    }
+    const auto dpiToDpm = 39.37;
+    return ScanImage(params.pixelsPerLine, params.lines, format,
+        resolution * dpiToDpm);
+}
+
 void Scanner::cancelScan()
 {
+    // also called when the scan was not started
     connect(this, &QtSaneScanner::optionsChanged,
-        this, &Scanner::optionValuesChanged);
-    connect(this, &QtSaneScanner::optionChanged,
-        this, &Scanner::optionValuesChanged);
+        this, &Scanner::handleOptionsChanged, Qt::UniqueConnection);
 
     QtSaneScanner::cancelScan();
 }
 
 void Scanner::setSource(const QString &source)
 {
-    setOptionValue(WellKnownOption::source, source);
+    if (auto option = getOption(WellKnownOption::Source))
+        option->setStringValue(source.toUtf8());
 }
 
 QString Scanner::getSource() const
 {
-    return getOptionValue(WellKnownOption::source).toString();
+    if (auto option = getOption(WellKnownOption::Source))
+        return QString::fromUtf8(option->stringValue());
+    return { };
 }
 
 void Scanner::setResolution(const QPointF &res)
 {
-    setOptionValue(WellKnownOption::resolution, std::min(res.x(), res.y()));
-    if (auto x_resolution = findOption(WellKnownOption::x_resolution))
-        x_resolution->setValue(res.x());
-    if (auto y_resolution = findOption(WellKnownOption::y_resolution))
-        y_resolution->setValue(res.y());
+    auto transaction = Transaction(this);
+    setOptionValue(WellKnownOption::Resolution, std::min(res.x(), res.y()));
+    if (auto x_resolution = getOption(WellKnownOption::XResolution))
+        x_resolution->setDoubleValue(res.x());
+    if (auto y_resolution = getOption(WellKnownOption::YResolution))
+        y_resolution->setDoubleValue(res.y());
 }
 
 QPointF Scanner::getResolution() const
 {
-    auto x_res = getOptionValue(WellKnownOption::resolution).toDouble();
+    auto x_res = getOptionValue(WellKnownOption::Resolution);
     auto y_res = x_res;
-    if (auto x_resolution = findOption(WellKnownOption::x_resolution))
-        x_res = x_resolution->value().toDouble();
-    if (auto y_resolution = findOption(WellKnownOption::y_resolution))
-        y_res = y_resolution->value().toDouble();
+    if (auto x_resolution = getOption(WellKnownOption::XResolution))
+        x_res = x_resolution->doubleValue();
+    if (auto y_resolution = getOption(WellKnownOption::YResolution))
+        y_res = y_resolution->doubleValue();
     return { x_res, y_res };
 }
 
 QStringList Scanner::getSources() const
 {
     auto list = QStringList();
-    const auto sources = findOption(WellKnownOption::source);
-    for (const auto &value : sources->allowedValues())
-        list.append(value.toString());
+    if (const auto sources = getOption(WellKnownOption::Source))
+        for (const auto &value : sources->allowedValues())
+            list.append(value.toString());
     return list;
 }
 
 QList<double> Scanner::getUniformResolutions() const
 {
+    // also called on the scan thread while preparing a preview
     auto list = QList<double>();
-    const auto x_res = findOption(WellKnownOption::x_resolution);
-    const auto y_res = findOption(WellKnownOption::y_resolution);
-    if (x_res && y_res && !x_res->allowedValues().isEmpty()) {
-        list = intersectLists(x_res->allowedValues(), y_res->allowedValues());
+    const auto x_res = getOption(WellKnownOption::XResolution);
+    const auto y_res = getOption(WellKnownOption::YResolution);
+    if (x_res && y_res && !currentDescriptor(*x_res).allowedValues().isEmpty()) {
+        list = intersectLists(currentDescriptor(*x_res).allowedValues(),
+            currentDescriptor(*y_res).allowedValues());
     }
-    else if (auto res = findOption(WellKnownOption::resolution)) {
-        if (!res->allowedValues().isEmpty()) {
-            for (const auto &value : res->allowedValues())
+    else if (auto option = getOption(WellKnownOption::Resolution)) {
+        const auto res = currentDescriptor(*option);
+        if (!res.allowedValues().isEmpty()) {
+            for (const auto &value : res.allowedValues())
                 list << value.toDouble();
         }
         else {
             // TODO: improve list
-            auto range = res->allowedRange();
+            auto range = res.allowedRange();
             const auto step = (range.max - range.min) / 10;
             for (auto value = range.min; value < range.max; value += step)
                 list << value;
@@ -160,36 +318,39 @@ QList<double> Scanner::getUniformResolutions() const
 
 void Scanner::setBounds(const QRectF &bounds)
 {
-    setOptionValue(WellKnownOption::top_left_x, bounds.topLeft().x());
-    setOptionValue(WellKnownOption::top_left_y, bounds.topLeft().y());
-    setOptionValue(WellKnownOption::bottom_right_x, bounds.bottomRight().x());
-    setOptionValue(WellKnownOption::bottom_right_y, bounds.bottomRight().y());
+    auto transaction = Transaction(this);
+    setOptionValue(WellKnownOption::TopLeftX, bounds.topLeft().x());
+    setOptionValue(WellKnownOption::TopLeftY, bounds.topLeft().y());
+    setOptionValue(WellKnownOption::BottomRightX, bounds.bottomRight().x());
+    setOptionValue(WellKnownOption::BottomRightY, bounds.bottomRight().y());
 }
 
 QRectF Scanner::getBounds() const
 {
     const auto topLeft = QPointF(
-        getOptionValue(WellKnownOption::top_left_x).toDouble(),
-        getOptionValue(WellKnownOption::top_left_y).toDouble());
+        getOptionValue(WellKnownOption::TopLeftX),
+        getOptionValue(WellKnownOption::TopLeftY));
     const auto bottomRight = QPointF(
-        getOptionValue(WellKnownOption::bottom_right_x).toDouble(),
-        getOptionValue(WellKnownOption::bottom_right_y).toDouble());
+        getOptionValue(WellKnownOption::BottomRightX),
+        getOptionValue(WellKnownOption::BottomRightY));
     return QRectF(topLeft, bottomRight);
 }
 
 QRectF Scanner::getMaximumBounds() const
 {
-    const auto br_x = findOption(WellKnownOption::bottom_right_x);
-    const auto br_y = findOption(WellKnownOption::bottom_right_y);
-    if (!br_x || !br_y)
+    const auto option_x = getOption(WellKnownOption::BottomRightX);
+    const auto option_y = getOption(WellKnownOption::BottomRightY);
+    if (!option_x || !option_y)
         return { };
 
-    const auto minMaxX = getMinMax(*br_x);
-    const auto minMaxY = getMinMax(*br_y);
+    const auto br_x = currentDescriptor(*option_x);
+    const auto br_y = currentDescriptor(*option_y);
+    const auto minMaxX = getMinMax(br_x);
+    const auto minMaxY = getMinMax(br_y);
     const auto rect = QRectF(minMaxX.first, minMaxY.first,
                              minMaxX.second, minMaxY.second);
 
-    if (br_x->unit() == Unit::Pixel) {
+    if (br_x.unit() == Unit::Pixel) {
         const auto dpi = getResolution();
         const auto pixelsToMM = QPointF(25.4 / dpi.x(), 25.4 / dpi.y());
         return QRectF{
@@ -202,3 +363,91 @@ QRectF Scanner::getMaximumBounds() const
     return rect;
 }
 
+void Scanner::setToneCurve(const ToneCurve &curve)
+{
+    auto lock = QMutexLocker(&mToneCurveMutex);
+    mToneCurve = curve;
+}
+
+ToneCurve Scanner::toneCurve() const
+{
+    auto lock = QMutexLocker(&mToneCurveMutex);
+    return mToneCurve;
+}
+
+bool Scanner::applyToneCurve(const ToneCurve &curve)
+{
+    // called on the scan thread, which does not update the descriptors
+    const auto customGamma = getOption(WellKnownOption::CustomGamma);
+    if (!customGamma || !currentDescriptor(*customGamma).isActive() ||
+        !currentDescriptor(*customGamma).isSettable())
+        return curve.isIdentity();
+
+    // keep setting of device, unless a curve was uploaded before
+    if (curve.isIdentity()) {
+        if (mToneCurveUploaded)
+            customGamma->setBoolValue(mCustomGammaEnabled);
+        mToneCurveUploaded = false;
+        return true;
+    }
+
+    // gamma tables only become active with custom gamma,
+    // the setting of the user is restored when no curve is uploaded
+    if (!mToneCurveUploaded)
+        mCustomGammaEnabled = customGamma->boolValue();
+    customGamma->setBoolValue(true);
+
+    const auto colorTables = {
+        std::make_pair(WellKnownOption::RedGammaTable, ToneCurve::Channel::Red),
+        std::make_pair(WellKnownOption::GreenGammaTable, ToneCurve::Channel::Green),
+        std::make_pair(WellKnownOption::BlueGammaTable, ToneCurve::Channel::Blue),
+    };
+    const auto hasColorTables = std::all_of(colorTables.begin(), colorTables.end(),
+        [&](const auto &table) { return canUploadGammaTable(table.first); });
+    const auto hasGammaTable = canUploadGammaTable(WellKnownOption::GammaTable);
+
+    if (curve.isUniform() && hasGammaTable) {
+        // color tables are usually applied in addition
+        uploadGammaTable(WellKnownOption::GammaTable, curve, ToneCurve::Channel::Gray);
+        for (const auto &table : colorTables)
+            if (canUploadGammaTable(table.first))
+                uploadGammaTable(table.first, ToneCurve(), table.second);
+    }
+    else if (hasColorTables) {
+        // master table is applied in addition
+        if (hasGammaTable)
+            uploadGammaTable(WellKnownOption::GammaTable, ToneCurve(),
+                ToneCurve::Channel::Gray);
+        for (const auto &table : colorTables)
+            uploadGammaTable(table.first, curve, table.second);
+    }
+    else {
+        // curve is applied on host, do not also apply uploaded tables
+        customGamma->setBoolValue(mCustomGammaEnabled);
+        mToneCurveUploaded = false;
+        return false;
+    }
+    mToneCurveUploaded = true;
+    return true;
+}
+
+bool Scanner::canUploadGammaTable(WellKnownOption option) const
+{
+    const auto table = getOption(option);
+    if (!table)
+        return false;
+    const auto descriptor = currentDescriptor(*table);
+    return (descriptor.isActive() && descriptor.isSettable() &&
+            descriptor.type() == Type::IntList);
+}
+
+void Scanner::uploadGammaTable(WellKnownOption option, const ToneCurve &curve,
+    ToneCurve::Channel channel)
+{
+    auto table = getOption(option);
+    const auto range = currentDescriptor(*table).allowedRange();
+    const auto maxValue = (range.max > range.min ?
+        static_cast<int>(range.max) : 255);
+    table->setListValue(curve.createTable(channel,
+        table->listValue().size(), maxValue));
+}
@@ -1,13 +1,30 @@
 #pragma once
 
 #include "qtsanescanner/src/qtsanescanner.h"
+#include "ScanImage.h"
+#include "ToneCurve.h"
+#include <QMutex>
+#include <array>
 
 class Scanner : public QtSaneScanner
 {
     Q_OBJECT
 
 public:
+    // settings which are affected by option changes
+    enum Settings : int {
+        SourceSetting = (1 << 0),
+        ResolutionSetting = (1 << 1),
+        BoundsSetting = (1 << 2),
+        AllSettings = SourceSetting | ResolutionSetting | BoundsSetting,
+    };
+
     explicit Scanner(const QString &deviceName);
+    Scanner(const QString &deviceName, QDataStream &snapshot);
+
+    static Scanner *loadSnapshot(const QString &deviceName,
+        const QString &fileName);
+    bool saveSnapshot(const QString &fileName) const;
 
     void setSource(const QString &source);
     QString getSource() const;
@@ -19,20 +36,69 @@ public:
     QRectF getBounds() const;
     void setBounds(const QRectF &bounds);
     QRectF getMaximumBounds() const;
-    QImage startScan(bool preview);
+    void setToneCurve(const ToneCurve &curve);
+    ToneCurve toneCurve() const;
+    // part of the tone curve the device did not apply, valid after start
+    const ToneCurve &hostToneCurve() const { return mHostToneCurve; }
+    ScanImage startScan(bool preview);
+    ScanImage startNextPage();
     void cancelScan();
 
 Q_SIGNALS:
-    void optionValuesChanged();
+    void settingsChanged(int settings);
 
 private:
-    void setOptionValue(const QString &name, const QVariant &value) {
-        if (auto option = findOption(name))
-            return option->setValue(value);
+    enum class WellKnownOption
+    {
+        Source,
+        Preview,
+        Resolution,
+        XResolution,
+        YResolution,
+        TopLeftX,
+        TopLeftY,
+        BottomRightX,
+        BottomRightY,
+        CustomGamma,
+        GammaTable,
+        RedGammaTable,
+        GreenGammaTable,
+        BlueGammaTable,
+        Count
+    };
+
+    void initializeOptions();
+    void resolveWellKnownOptions();
+    void handleOptionsChanged(const OptionChanges &changes);
+    bool isAffected(const OptionChanges &changes, WellKnownOption option) const;
+    ScanImage createScanImage(const QPointF &resolution) const;
+    bool applyToneCurve(const ToneCurve &curve);
+    bool canUploadGammaTable(WellKnownOption option) const;
+    void uploadGammaTable(WellKnownOption option, const ToneCurve &curve,
+        ToneCurve::Channel channel);
+    Option *getOption(WellKnownOption option) {
+        const auto index = mWellKnownOptions[static_cast<int>(option)];
+        return (index >= 0 ? &this->option(index) : nullptr);
     }
-    QVariant getOptionValue(const QString &name) const {
-        if (auto option = findOption(name))
-            return option->value();
-        return { };
+    const Option *getOption(WellKnownOption option) const {
+        const auto index = mWellKnownOptions[static_cast<int>(option)];
+        return (index >= 0 ? &this->option(index) : nullptr);
     }
+    void setOptionValue(WellKnownOption option, double value) {
+        if (auto opt = getOption(option))
+            opt->setDoubleValue(value);
+    }
+    double getOptionValue(WellKnownOption option) const {
+        if (auto opt = getOption(option))
+            return opt->doubleValue();
+        return 0;
+    }
+
+    std::array<int, static_cast<int>(WellKnownOption::Count)> mWellKnownOptions{ };
+    mutable QMutex mToneCurveMutex;
+    ToneCurve mToneCurve;
+    ToneCurve mHostToneCurve;
+    bool mToneCurveUploaded{ };
+    // setting of the user, before a curve was uploaded
+    bool mCustomGammaEnabled{ };
 };
@@ -0,0 +1,99 @@
+#include "ScannerPool.h"
+#include "Scanner.h"
+#include <algorithm>
+
+ScannerPool::ScannerPool(QObject *parent)
+    : QObject(parent)
+{
+    connect(&mIdleTimer, &QTimer::timeout,
+        this, &ScannerPool::closeIdleScanners);
+}
+
+ScannerPool::~ScannerPool()
+{
+    clear();
+}
+
+void ScannerPool::setMaximumSize(int maximumSize)
+{
+    mMaximumSize = maximumSize;
+    closeExcessScanners();
+}
+
+void ScannerPool::setIdleTimeout(int msec)
+{
+    mIdleTimeout = msec;
+    closeIdleScanners();
+}
+
+void ScannerPool::setInUseCheck(std::function<bool(const QString&)> isInUse)
+{
+    mIsInUse = std::move(isInUse);
+}
+
+Scanner *ScannerPool::take(const QString &deviceName)
+{
+    for (auto i = 0; i < mEntries.size(); ++i)
+        if (mEntries[i].scanner->deviceName() == deviceName)
+            return mEntries.takeAt(i).scanner;
+    return nullptr;
+}
+
+void ScannerPool::release(Scanner *scanner)
+{
+    if (!scanner)
+        return;
+
+    auto entry = Entry{ scanner, { } };
+    entry.idleTime.start();
+    mEntries.append(entry);
+    closeExcessScanners();
+
+    // also retries closing devices which were still in use
+    if (!mEntries.isEmpty() && !mIdleTimer.isActive())
+        mIdleTimer.start(std::max(mIdleTimeout / 10, 1000));
+}
+
+void ScannerPool::clear()
+{
+    while (!mEntries.isEmpty())
+        closeScanner(0);
+}
+
+void ScannerPool::closeIdleScanners()
+{
+    for (auto i = 0; i < mEntries.size(); )
+        if (mEntries[i].idleTime.hasExpired(mIdleTimeout) &&
+            !isInUse(mEntries[i].scanner))
+            closeScanner(i);
+        else
+            ++i;
+    closeExcessScanners();
+
+    if (mEntries.isEmpty())
+        mIdleTimer.stop();
+}
+
+void ScannerPool::closeExcessScanners()
+{
+    // close least recently used devices which are not in use
+    for (auto i = 0; i < mEntries.size() &&
+            mEntries.size() > std::max(mMaximumSize, 0); )
+        if (!isInUse(mEntries[i].scanner))
+            closeScanner(i);
+        else
+            ++i;
+}
+
+bool ScannerPool::isInUse(const Scanner *scanner) const
+{
+    // the session's worker may still access it, after the scan stopped
+    if (mIsInUse)
+        return mIsInUse(scanner->deviceName());
+    return scanner->isScanning();
+}
+
+void ScannerPool::closeScanner(int index)
+{
+    delete mEntries.takeAt(index).scanner;
+}
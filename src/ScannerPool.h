@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <functional>
+
+class Scanner;
+
+class ScannerPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ScannerPool(QObject *parent = nullptr);
+    ~ScannerPool();
+
+    void setMaximumSize(int maximumSize);
+    void setIdleTimeout(int msec);
+    // devices which are still used by a scanning session are not closed
+    void setInUseCheck(std::function<bool(const QString&)> isInUse);
+    Scanner *take(const QString &deviceName);
+    void release(Scanner *scanner);
+    void clear();
+
+private:
+    struct Entry
+    {
+        Scanner *scanner;
+        QElapsedTimer idleTime;
+    };
+
+    void closeIdleScanners();
+    void closeExcessScanners();
+    bool isInUse(const Scanner *scanner) const;
+    void closeScanner(int index);
+
+    // least recently used first
+    QList<Entry> mEntries;
+    QTimer mIdleTimer;
+    std::function<bool(const QString&)> mIsInUse;
+    int mMaximumSize{ 2 };
+    int mIdleTimeout{ 10 * 60 * 1000 };
+};
@@ -0,0 +1,112 @@
+#include "ToneCurve.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    template<typename T>
+    void applyTable(T *samples, int count, const quint16 *table)
+    {
+        for (auto i = 0; i < count; ++i)
+            samples[i] = static_cast<T>(table[samples[i]]);
+    }
+
+    template<typename T>
+    void applyTables(T *samples, int count, const quint16 *red,
+        const quint16 *green, const quint16 *blue)
+    {
+        for (auto i = 0; i + 2 < count; i += 3) {
+            samples[i] = static_cast<T>(red[samples[i]]);
+            samples[i + 1] = static_cast<T>(green[samples[i + 1]]);
+            samples[i + 2] = static_cast<T>(blue[samples[i + 2]]);
+        }
+    }
+} // namespace
+
+ToneCurve::ToneCurve(double gamma)
+{
+    mGamma.fill(gamma);
+}
+
+double ToneCurve::gamma(Channel channel) const
+{
+    return mGamma[static_cast<int>(channel)];
+}
+
+void ToneCurve::setGamma(Channel channel, double gamma)
+{
+    mGamma[static_cast<int>(channel)] = gamma;
+}
+
+bool ToneCurve::isIdentity() const
+{
+    return std::all_of(mGamma.begin(), mGamma.end(),
+        [](double gamma) { return gamma == 1.0; });
+}
+
+bool ToneCurve::isUniform() const
+{
+    return std::all_of(mGamma.begin(), mGamma.end(),
+        [&](double gamma) { return gamma == mGamma.front(); });
+}
+
+QVector<int> ToneCurve::createTable(Channel channel, int size, int maxValue) const
+{
+    auto table = QVector<int>(size);
+    if (size < 2)
+        return table;
+
+    const auto exponent = 1.0 / std::max(gamma(channel), 0.01);
+    for (auto i = 0; i < size; ++i) {
+        const auto x = static_cast<double>(i) / (size - 1);
+        table[i] = static_cast<int>(std::lround(std::pow(x, exponent) * maxValue));
+    }
+    return table;
+}
+
+ToneCurveLookup::ToneCurveLookup(const ToneCurve &curve, int depth)
+{
+    // only 8 and 16 bit samples can be looked up
+    if (curve.isIdentity() || (depth != 8 && depth != 16))
+        return;
+
+    mDepth = depth;
+    const auto size = 1 << depth;
+    for (auto i = 0; i < static_cast<int>(ToneCurve::Channel::Count); ++i) {
+        const auto table = curve.createTable(
+            static_cast<ToneCurve::Channel>(i), size, size - 1);
+        mTables[i] = QVector<quint16>(table.begin(), table.end());
+    }
+}
+
+void ToneCurveLookup::apply(char *lines, int lineCount, int bytesPerLine,
+    QtSaneScanner::Frame frame) const
+{
+    if (isNull())
+        return;
+
+    const auto table = [&](ToneCurve::Channel channel) {
+        return mTables[static_cast<int>(channel)].constData();
+    };
+    using Channel = ToneCurve::Channel;
+    using Frame = QtSaneScanner::Frame;
+    const auto lookup = [&](auto *samples, int count) {
+        switch (frame) {
+            case Frame::Gray: return applyTable(samples, count, table(Channel::Gray));
+            case Frame::Red: return applyTable(samples, count, table(Channel::Red));
+            case Frame::Green: return applyTable(samples, count, table(Channel::Green));
+            case Frame::Blue: return applyTable(samples, count, table(Channel::Blue));
+            case Frame::RGB: return applyTables(samples, count,
+                table(Channel::Red), table(Channel::Green), table(Channel::Blue));
+        }
+    };
+
+    // channels of interleaved samples start again at each line
+    for (auto y = 0; y < lineCount; ++y) {
+        const auto line = lines + y * bytesPerLine;
+        if (mDepth == 8)
+            lookup(reinterpret_cast<uchar*>(line), bytesPerLine);
+        else
+            lookup(reinterpret_cast<quint16*>(line), bytesPerLine / 2);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "qtsanescanner/src/qtsanescanner.h"
+#include <QVector>
+#include <array>
+
+// gamma correction of each channel
+class ToneCurve
+{
+public:
+    enum class Channel
+    {
+        Gray,
+        Red,
+        Green,
+        Blue,
+        Count
+    };
+
+    ToneCurve() = default;
+    explicit ToneCurve(double gamma);
+
+    double gamma(Channel channel) const;
+    void setGamma(Channel channel, double gamma);
+    bool isIdentity() const;
+    bool isUniform() const;
+    QVector<int> createTable(Channel channel, int size, int maxValue) const;
+
+    bool operator==(const ToneCurve &other) const { return mGamma == other.mGamma; }
+    bool operator!=(const ToneCurve &other) const { return !(*this == other); }
+
+private:
+    std::array<double, static_cast<int>(Channel::Count)> mGamma{ 1, 1, 1, 1 };
+};
+
+// applies a tone curve to scanned lines, when the device could not
+class ToneCurveLookup
+{
+public:
+    ToneCurveLookup() = default;
+    ToneCurveLookup(const ToneCurve &curve, int depth);
+
+    bool isNull() const { return (mDepth == 0); }
+    void apply(char *lines, int lineCount, int bytesPerLine,
+        QtSaneScanner::Frame frame) const;
+
+private:
+    int mDepth{ };
+    std::array<QVector<quint16>, static_cast<int>(ToneCurve::Channel::Count)> mTables;
+};
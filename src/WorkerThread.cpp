@@ -1,10 +1,26 @@
 #include "WorkerThread.h"
 #include "Scanner.h"
+#include "PageWriter.h"
+#include <QDebug>
+
+namespace
+{
+    // time for a cancelled read to return
+    const auto abortTimeoutMsec = 10000;
+    // time for the thread to stop when it is destroyed
+    const auto stopTimeoutMsec = 3000;
+} // namespace
 
 class Worker final : public QObject
 {
     Q_OBJECT
 
+public:
+    explicit Worker(ScanWatchdog *watchdog)
+        : mWatchdog(*watchdog)
+    {
+    }
+
 public Q_SLOTS:
     void stop() noexcept
     {
@@ -19,8 +35,49 @@ public Q_SLOTS:
         if (image.isNull())
             return complete(false);
 
-        Q_EMIT scanStarted(image);
-        scanNextScanLine();
+        mWatchdog.start(mScanner->parameters());
+        createToneCurveLookup();
+        Q_EMIT scanStarted(std::move(image));
+        startReading();
+    }
+
+    void scanBatch(Scanner *scanner, PageWriter *pageWriter) noexcept
+    {
+        mScanner = scanner;
+        mPageWriter = pageWriter;
+
+        // wait for a free page without blocking, so a cancel is handled
+        connect(mPageWriter, &PageWriter::pageReleased,
+            this, &Worker::acquirePage, Qt::UniqueConnection);
+        acquirePage();
+    }
+
+    // can be called from the owner thread, when the scan hung
+    void releaseAcquiredPage() noexcept
+    {
+        if (auto pageWriter = mAcquiredPage.fetchAndStoreOrdered(nullptr))
+            pageWriter->releasePage();
+    }
+
+    void acquirePage() noexcept
+    {
+        if (!mPageWriter || mAcquiredPage.loadAcquire() ||
+            !mPageWriter->tryAcquirePage())
+            return;
+        mAcquiredPage.storeRelease(mPageWriter);
+
+        // scan continues with the next page of the feeder
+        if (mScanner->isScanning())
+            return startNextPage();
+
+        auto image = mScanner->startScan(false);
+        if (image.isNull())
+            return complete(false);
+
+        mWatchdog.start(mScanner->parameters());
+        createToneCurveLookup();
+        Q_EMIT scanStarted(std::move(image));
+        startReading();
     }
 
     void cancelScan() noexcept
@@ -28,72 +85,234 @@ public Q_SLOTS:
         complete(false);
     }
 
-    void scanNextScanLine() noexcept
+    void scanNextScanLines() noexcept
     {
-        if (mScanner) {
-            auto scanLine = mScanner->readScanLine();
-            if (scanLine.isEmpty())
-                return complete(true);
+        // reading is paused while waiting for a free page
+        if (mScanner && (!mPageWriter || mAcquiredPage.loadAcquire())) {
+            if (!mScanner->readScanLines(mScanBuffer)) {
+                if (mPageWriter && mScanner->isPageComplete())
+                    return finishPage();
+                return complete(mScanner->isPageComplete());
+            }
 
-            Q_EMIT scanLineScanned(scanLine);
+            const auto bytesPerLine = mScanBuffer.bytesPerLine();
+            if (const auto lineCount = mScanBuffer.lineCount()) {
+                mWatchdog.progress(lineCount * bytesPerLine);
+                auto scanLines = QByteArray(mScanBuffer.lines(),
+                    lineCount * bytesPerLine);
+                mToneCurveLookup.apply(scanLines.data(), lineCount,
+                    bytesPerLine, mScanBuffer.frame());
+                Q_EMIT scanLinesScanned(std::move(scanLines), bytesPerLine,
+                    mScanBuffer.frame());
+            }
+
+            // continue blocking read after pending events were processed
+            if (!mScanner->isNonBlocking())
+                QMetaObject::invokeMethod(this, &Worker::scanNextScanLines,
+                    Qt::QueuedConnection);
         }
     }
 
 Q_SIGNALS:
-    void scanStarted(QImage image);
-    void scanLineScanned(QByteArray scanLine);
+    void scanStarted(ScanImage image);
+    void pageScanned();
+    void scanLinesScanned(QByteArray scanLines, int bytesPerLine,
+        QtSaneScanner::Frame frame);
     void scanComplete(bool succeeded);
+    void scanStatisticsRecorded(QtSaneScanner::ScanStatistics statistics);
 
 private:
+    void startReading() noexcept
+    {
+        // read when data is available, otherwise fall back to blocking reads
+        if (mScanner->setNonBlocking(true)) {
+            connect(mScanner, &QtSaneScanner::scanDataAvailable,
+                this, &Worker::scanNextScanLines, Qt::UniqueConnection);
+            return;
+        }
+        scanNextScanLines();
+    }
+
+    void finishPage() noexcept
+    {
+        // waiting for the page writer is no stall
+        mWatchdog.stop();
+
+        // page was released when the scan hung
+        if (!mAcquiredPage.fetchAndStoreOrdered(nullptr))
+            return complete(false);
+
+        // page is handed over to the page writer, the select descriptor
+        // is not watched while waiting for a free page
+        mScanner->setNonBlocking(false);
+        Q_EMIT pageScanned();
+
+        // next page is read while previous pages are being written
+        acquirePage();
+    }
+
+    void startNextPage() noexcept
+    {
+        // only an empty feeder ends the batch successfully, not a jam
+        auto image = mScanner->startNextPage();
+        if (image.isNull())
+            return complete(mScanner->isOutOfDocuments());
+
+        mWatchdog.start(mScanner->parameters());
+        if (mScanner->parameters().depth != mToneCurveDepth)
+            createToneCurveLookup();
+        Q_EMIT scanStarted(std::move(image));
+        startReading();
+    }
+
+    void createToneCurveLookup() noexcept
+    {
+        // tone curve which could not be uploaded to the device
+        mToneCurveDepth = mScanner->parameters().depth;
+        mToneCurveLookup = ToneCurveLookup(mScanner->hostToneCurve(),
+            mToneCurveDepth);
+    }
+
     void complete(bool succeeded) noexcept
     {
+        mWatchdog.stop();
+        if (mPageWriter)
+            disconnect(mPageWriter, &PageWriter::pageReleased,
+                this, &Worker::acquirePage);
+        releaseAcquiredPage();
+        mPageWriter = nullptr;
+
         if (mScanner) {
+            disconnect(mScanner, &QtSaneScanner::scanDataAvailable,
+                this, &Worker::scanNextScanLines);
+            // no statistics when waiting for the first page was cancelled
+            if (mScanner->isScanning())
+                Q_EMIT scanStatisticsRecorded(mScanner->scanStatistics());
             mScanner->cancelScan();
             mScanner = nullptr;
             Q_EMIT scanComplete(succeeded);
         }
     }
 
+    ScanWatchdog &mWatchdog;
     Scanner *mScanner{ };
+    PageWriter *mPageWriter{ };
+    // page writer of the acquired page, which is also
+    // released by the owner thread, when the scan hung
+    QAtomicPointer<PageWriter> mAcquiredPage;
+    QtSaneScanner::ScanBuffer mScanBuffer;
+    ToneCurveLookup mToneCurveLookup;
+    int mToneCurveDepth{ };
 };
 
 WorkerThread::WorkerThread(QObject *parent)
     : QObject(parent)
-    , mWorker(new Worker())
+    , mThread(new QThread())
+    , mWatchdog(new ScanWatchdog())
+    , mWorker(new Worker(mWatchdog.data()))
 {
-    mWorker->moveToThread(&mThread);
+    qRegisterMetaType<ScanImage>();
+    qRegisterMetaType<QtSaneScanner::ScanStatistics>();
+    qRegisterMetaType<QtSaneScanner::OptionChanges>();
+
+    mWorker->moveToThread(mThread.data());
 
     connect(this, &WorkerThread::doScan,
         mWorker.data(), &Worker::scan);
+    connect(this, &WorkerThread::doScanBatch,
+        mWorker.data(), &Worker::scanBatch);
     connect(this, &WorkerThread::doCancelScan,
         mWorker.data(), &Worker::cancelScan);
 
     connect(mWorker.data(), &Worker::scanStarted,
         this, &WorkerThread::scanStarted);
+    connect(mWorker.data(), &Worker::pageScanned,
+        this, &WorkerThread::pageScanned);
     connect(mWorker.data(), &Worker::scanComplete,
-        this, &WorkerThread::scanComplete);
-    connect(mWorker.data(), &Worker::scanLineScanned,
-        this, &WorkerThread::scanLineScanned);
-    connect(mWorker.data(), &Worker::scanLineScanned,
-        mWorker.data(), &Worker::scanNextScanLine, Qt::QueuedConnection);
+        this, &WorkerThread::handleScanComplete);
+    connect(mWorker.data(), &Worker::scanLinesScanned,
+        this, &WorkerThread::scanLinesScanned);
+    connect(mWorker.data(), &Worker::scanStatisticsRecorded,
+        this, &WorkerThread::scanStatisticsRecorded);
 
-    mThread.start();
+    connect(mWatchdog.data(), &ScanWatchdog::stalled,
+        this, &WorkerThread::handleScanStalled);
+    mAbortTimer.setSingleShot(true);
+    connect(&mAbortTimer, &QTimer::timeout,
+        this, &WorkerThread::handleScanHung);
+
+    mThread->start();
 }
 
 WorkerThread::~WorkerThread()
 {
-    QMetaObject::invokeMethod(mWorker.data(),
-        "stop", Qt::BlockingQueuedConnection);
+    if (stop())
+        return;
+
+    // a read which hung in the backend may never return, the thread is
+    // left running and the objects it still uses are leaked deliberately
+    qWarning() << "leaving reading thread behind";
+    mWorker->releaseAcquiredPage();
+    mWorker.take();
+    mWatchdog.take();
+    mThread.take();
+}
+
+bool WorkerThread::stop()
+{
+    if (mThread->isFinished())
+        return true;
+
+    // unblock a hanging read, stopping is only waited for a while
+    if (mScanner)
+        mScanner->abortScan();
+    QMetaObject::invokeMethod(mWorker.data(), "stop", Qt::QueuedConnection);
+    return mThread->wait(stopTimeoutMsec);
 }
 
 void WorkerThread::scan(Scanner* scanner, bool preview)
 {
+    mScanner = scanner;
     Q_EMIT doScan(scanner, preview, QPrivateSignal());
 }
 
+void WorkerThread::scanBatch(Scanner *scanner, PageWriter *pageWriter)
+{
+    mScanner = scanner;
+    Q_EMIT doScanBatch(scanner, pageWriter, QPrivateSignal());
+}
+
 void WorkerThread::cancelScan()
 {
     Q_EMIT doCancelScan(QPrivateSignal());
 }
 
+void WorkerThread::handleScanStalled(QString diagnostics)
+{
+    if (!mScanner)
+        return;
+
+    qWarning() << "scan stalled:" << diagnostics;
+    Q_EMIT scanStalled(diagnostics);
+
+    // unblock a hanging read, a waiting worker is cancelled regularly
+    mScanner->abortScan();
+    cancelScan();
+    mAbortTimer.start(abortTimeoutMsec);
+}
+
+void WorkerThread::handleScanHung()
+{
+    // page of a hung batch is not kept from the other devices
+    mWorker->releaseAcquiredPage();
+    Q_EMIT scanHung();
+}
+
+void WorkerThread::handleScanComplete(bool succeeded)
+{
+    mScanner = nullptr;
+    mAbortTimer.stop();
+    Q_EMIT scanComplete(succeeded);
+}
+
 #include "WorkerThread.moc"
@@ -3,8 +3,10 @@
 #include <QObject>
 #include <QThread>
 #include "Scanner.h"
+#include "ScanWatchdog.h"
 
 class Worker;
+class PageWriter;
 
 class WorkerThread : public QObject
 {
@@ -14,16 +16,35 @@ public:
     ~WorkerThread();
 
     void scan(Scanner *scanner, bool preview);
+    void scanBatch(Scanner *scanner, PageWriter *pageWriter);
     void cancelScan();
+    // returns false when the thread did not stop in time, because
+    // a read hung in the backend, it is then left running
+    bool stop();
+    QThread *deviceThread() { return mThread.data(); }
 
 Q_SIGNALS:
     void doScan(Scanner *scanner, bool preview, QPrivateSignal);
+    void doScanBatch(Scanner *scanner, PageWriter *pageWriter, QPrivateSignal);
     void doCancelScan(QPrivateSignal);
-    void scanStarted(QImage image);
+    void scanStarted(ScanImage image);
+    void pageScanned();
     void scanComplete(bool succeeded);
-    void scanLineScanned(QByteArray scanLine);
+    void scanLinesScanned(QByteArray scanLines, int bytesPerLine,
+        QtSaneScanner::Frame frame);
+    void scanStatisticsRecorded(QtSaneScanner::ScanStatistics statistics);
+    // scan is cancelled, when the read does not return it is hung
+    void scanStalled(QString diagnostics);
+    void scanHung();
 
 private:
-    QThread mThread;
+    void handleScanStalled(QString diagnostics);
+    void handleScanHung();
+    void handleScanComplete(bool succeeded);
+
+    QScopedPointer<QThread> mThread;
+    QScopedPointer<ScanWatchdog> mWatchdog;
+    QTimer mAbortTimer;
+    Scanner *mScanner{ };
     QScopedPointer<Worker> mWorker;
 };
@@ -1,11 +1,16 @@
 #include "MainWindow.h"
+#include "DeviceDiscovery.h"
 #include <QApplication>
 #include <QTranslator>
 #include <QLibraryInfo>
 #include <QDebug>
+#include <cstring>
 
 int main(int argc, char *argv[]) try
 {
+    if (argc == 2 && !std::strcmp(argv[1], DeviceDiscovery::HelperArgument))
+        return DeviceDiscovery::printDevices();
+
     QCoreApplication::setOrganizationName("qsane");
     QCoreApplication::setApplicationName("QSane");
 #if __has_include("_version.h")
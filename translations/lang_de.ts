@@ -11,6 +11,10 @@
         <source>Resolution</source>
         <translation>Auflösung</translation>
     </message>
+    <message>
+        <source>Gamma</source>
+        <translation>Gamma</translation>
+    </message>
     <message>
         <source>Source</source>
         <translation>Quelle</translation>
@@ -61,5 +65,17 @@ Soll sie ersetzt werden?</translation>
         <source>Writing image file failed</source>
         <translation>Die Datei konnte nicht geschrieben werden</translation>
     </message>
+    <message>
+        <source>Writing image file "%1" failed</source>
+        <translation>Die Datei "%1" konnte nicht geschrieben werden</translation>
+    </message>
+    <message>
+        <source>Batch</source>
+        <translation>Stapel</translation>
+    </message>
+    <message>
+        <source>Save all pages of feeder</source>
+        <translation>Alle Seiten des Einzugs speichern</translation>
+    </message>
 </context>
 </TS>